@@ -45,7 +45,7 @@ ClientChunk ClientChunkManager::implOnCreate(const chunkpos_t &cp)
 
 voxel_t ClientChunkManager::implGetVoxel(const ClientChunk &data, const localpos_t &lp) const
 {
-    return data.data[toVoxelIdx(lp)];
+    return data.data.get(toVoxelIdx(lp));
 }
 
 void ClientChunkManager::implSetVoxel(ClientChunk *data, const chunkpos_t &cp, const localpos_t &lp, voxel_t voxel, voxel_set_flags_t flags)
@@ -65,6 +65,6 @@ void ClientChunkManager::implSetVoxel(ClientChunk *data, const chunkpos_t &cp, c
             globals::registry.emplace_or_replace<ChunkFlaggedForMeshingComponent>(nc->entity);
     }
 
-    data->data[toVoxelIdx(lp)] = voxel;
+    data->data.set(toVoxelIdx(lp), voxel);
     globals::registry.emplace_or_replace<ChunkFlaggedForMeshingComponent>(data->entity);
 }
@@ -6,10 +6,11 @@
 #pragma once
 #include <entt/entt.hpp>
 #include <shared/chunks.hpp>
+#include <shared/voxel_storage.hpp>
 
 struct ClientChunk final {
     entt::entity entity;
-    voxel_array_t data;
+    VoxelStorage data;
 };
 
 class ClientChunkManager final : public ChunkManager<ClientChunk, ClientChunkManager> {
@@ -3,6 +3,7 @@
  * Copyright (c) 2021, Kirill GPRB.
  * All Rights Reserved.
  */
+#include <common/util/clock.hpp>
 #include <exception>
 #include <client/chunks.hpp>
 #include <client/globals.hpp>
@@ -15,6 +16,7 @@
 #include <shared/protocol/packets/client/handshake.hpp>
 #include <shared/protocol/packets/client/login_start.hpp>
 #include <shared/protocol/packets/server/chunk_voxels.hpp>
+#include <shared/protocol/packets/server/chunk_voxels_rle.hpp>
 #include <shared/protocol/packets/server/login_success.hpp>
 #include <shared/protocol/packets/server/player_info_entry.hpp>
 #include <shared/protocol/packets/server/player_info_username.hpp>
@@ -30,6 +32,7 @@
 #include <shared/protocol/packets/shared/update_creature.hpp>
 #include <shared/protocol/packets/shared/update_head.hpp>
 #include <shared/util/enet.hpp>
+#include <shared/voxel_rle.hpp>
 #include <shared/voxels.hpp>
 #include <spdlog/spdlog.h>
 #include <vector>
@@ -100,8 +103,25 @@ static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &)>
         [](const std::vector<uint8_t> &payload) {
             protocol::packets::ChunkVoxels packet;
             protocol::deserialize(payload, packet);
-            globals::chunks.create(math::arrayToVec<chunkpos_t>(packet.position))->data = packet.data;
-            spdlog::info("RECEIVED [{}, {}, {}]", packet.position[0], packet.position[1], packet.position[2]);
+            globals::chunks.create(math::arrayToVec<chunkpos_t>(packet.position))->data.assign(packet.data);
+            spdlog::info("RECEIVED [{}, {}, {}] raw, {} bytes", packet.position[0], packet.position[1], packet.position[2], payload.size());
+        }
+    },
+    {
+        protocol::packets::ChunkVoxelsRLE::id,
+        [](const std::vector<uint8_t> &payload) {
+            protocol::packets::ChunkVoxelsRLE packet;
+            protocol::deserialize(payload, packet);
+
+            ChronoClock<std::chrono::steady_clock> clock;
+            voxel_array_t data;
+            if(!voxel_rle::decode(packet.data.data(), packet.data.size(), data)) {
+                spdlog::warn("ChunkVoxelsRLE: invalid data for [{}, {}, {}]", packet.position[0], packet.position[1], packet.position[2]);
+                return;
+            }
+
+            globals::chunks.create(math::arrayToVec<chunkpos_t>(packet.position))->data.assign(data);
+            spdlog::info("RECEIVED [{}, {}, {}] RLE, {} bytes, decoded in {:.2f} us", packet.position[0], packet.position[1], packet.position[2], payload.size(), util::seconds<float>(clock.elapsed()) * 1.0e6f);
         }
     },
     {
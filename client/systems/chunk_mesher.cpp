@@ -92,7 +92,7 @@ const bool ThreadedMeshingContext::hasVoxelAt(const chunkpos_t &cp, const localp
 {
     const voxelpos_t vp = toVoxelPos(cp, lp);
     if(const ClientChunk *cc = globals::chunks.find(toChunkPos(vp)))
-        return cc->data.at(toVoxelIdx(toLocalPos(vp))) == voxel;
+        return cc->data.get(toVoxelIdx(toLocalPos(vp))) == voxel;
     return false;
 }
 
@@ -100,7 +100,7 @@ const bool ThreadedMeshingContext::hasFaceAt(const chunkpos_t &cp, const localpo
 {
     const voxelpos_t vp = toVoxelPos(cp, lp);
     if(const ClientChunk *cc = globals::chunks.find(toChunkPos(vp))) {
-        if(const voxel_t voxel = cc->data.at(toVoxelIdx(toLocalPos(vp)))) {
+        if(const voxel_t voxel = cc->data.get(toVoxelIdx(toLocalPos(vp)))) {
             if(const VoxelDefEntry *vde = globals::voxels.find(voxel)) {
                 const auto jt = vde->faces.find(face);
                 if(jt != vde->faces.cend())
@@ -312,6 +312,41 @@ void ThreadedMeshingContext::threadFunc()
     }
 }
 
+static inline bool isOpaqueChunk(const ClientChunk *cc)
+{
+    if(!cc || !cc->data.isUniform())
+        return false;
+
+    if(const VoxelDefEntry *vde = globals::voxels.find(cc->data.getUniform())) {
+        for(const voxel_face_t face : { VOXEL_FACE_LF, VOXEL_FACE_RT, VOXEL_FACE_FT, VOXEL_FACE_BK, VOXEL_FACE_UP, VOXEL_FACE_DN }) {
+            const auto it = vde->faces.find(face);
+            if(it == vde->faces.cend() || it->second.transparent)
+                return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+// Uniform chunks that can't produce any faces: air
+// or a solid chunk buried between other solid chunks.
+static inline bool isHiddenChunk(const chunkpos_t &cp, const ClientChunk *cc)
+{
+    if(!cc->data.isUniform())
+        return false;
+    if(cc->data.getUniform() == NULL_VOXEL)
+        return true;
+    return isOpaqueChunk(cc)
+        && isOpaqueChunk(globals::chunks.find(cp + chunkpos_t(0, 0, 1)))
+        && isOpaqueChunk(globals::chunks.find(cp - chunkpos_t(0, 0, 1)))
+        && isOpaqueChunk(globals::chunks.find(cp + chunkpos_t(0, 1, 0)))
+        && isOpaqueChunk(globals::chunks.find(cp - chunkpos_t(0, 1, 0)))
+        && isOpaqueChunk(globals::chunks.find(cp + chunkpos_t(1, 0, 0)))
+        && isOpaqueChunk(globals::chunks.find(cp - chunkpos_t(1, 0, 0)));
+}
+
 static void pushWorker(ThreadedMeshingContextPtr ctx)
 {
     for(auto it = mesher_workers.begin(); it != mesher_workers.end(); it++) {
@@ -414,6 +449,11 @@ void chunk_mesher::update()
     for(const auto [entity, chunk] : group.each()) {
         globals::registry.remove<ChunkFlaggedForMeshingComponent>(entity);
         if(const ClientChunk *cc = globals::chunks.find(chunk.position)) {
+            if(isHiddenChunk(chunk.position, cc)) {
+                globals::registry.remove<ChunkMeshComponent>(entity);
+                continue;
+            }
+
             ThreadedMeshingContextPtr ctx = std::make_shared<ThreadedMeshingContext>(chunk.position, entity);
             pushWorker(ctx);
             ctx->enqueue();
@@ -6,6 +6,15 @@
 #include <common/filesystem.hpp>
 #include <iterator>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 static stdfs::path root_path;
 static std::vector<stdfs::path> mount_points;
 
@@ -54,18 +63,26 @@ bool fs::readBytes(const stdfs::path &path, std::vector<uint8_t> &buffer)
     if(!ifs.is_open())
         return false;
 
-    ifs.unsetf(std::ios::skipws);
-
     ifs.seekg(0, std::ios::end);
     buffer.resize(static_cast<size_t>(ifs.tellg()));
     ifs.seekg(0, std::ios::beg);
 
-    buffer.insert(buffer.begin(), std::istream_iterator<char>(ifs), std::istream_iterator<char>());
+    ifs.read(reinterpret_cast<char *>(buffer.data()), buffer.size());
+    buffer.resize(static_cast<size_t>(ifs.gcount()));
 
     ifs.close();
     return true;
 }
 
+size_t fs::readBytes(const stdfs::path &path, void *buffer, size_t size)
+{
+    std::ifstream ifs(fs::getFullPath(path), std::ios::binary);
+    if(!ifs.is_open())
+        return 0;
+    ifs.read(reinterpret_cast<char *>(buffer), size);
+    return static_cast<size_t>(ifs.gcount());
+}
+
 bool fs::writeBytes(const stdfs::path &path, const std::vector<uint8_t> &buffer)
 {
     std::ofstream ofs(fs::getWritePath(path), std::ios::binary);
@@ -107,6 +124,25 @@ bool fs::writeText(const stdfs::path &path, const std::string &buffer)
     return true;
 }
 
+bool fs::syncFile(const stdfs::path &path)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+    const bool result = FlushFileBuffers(file);
+    CloseHandle(file);
+    return result;
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    const bool result = (fsync(fd) == 0);
+    ::close(fd);
+    return result;
+#endif
+}
+
 const stdfs::path fs::getFullPath(stdfs::path path)
 {
     for(const stdfs::path &it : mount_points) {
@@ -125,3 +161,110 @@ const stdfs::path fs::getWritePath(stdfs::path path)
     // We can write only in the root directory
     return root_path / path;
 }
+
+fs::MappedFile::MappedFile(fs::MappedFile &&rhs)
+    : opened(rhs.opened), view(rhs.view), length(rhs.length)
+{
+    rhs.opened = false;
+    rhs.view = nullptr;
+    rhs.length = 0;
+}
+
+fs::MappedFile &fs::MappedFile::operator=(fs::MappedFile &&rhs)
+{
+    if(this != &rhs) {
+        close();
+        opened = rhs.opened;
+        view = rhs.view;
+        length = rhs.length;
+        rhs.opened = false;
+        rhs.view = nullptr;
+        rhs.length = 0;
+    }
+
+    return *this;
+}
+
+fs::MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool fs::MappedFile::open(const stdfs::path &path)
+{
+    close();
+
+    const stdfs::path full_path = fs::getFullPath(path);
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(full_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    length = static_cast<size_t>(file_size.QuadPart);
+    if(length) {
+        // The view keeps the mapping object alive
+        // so both handles can be closed right away.
+        HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping)
+            view = reinterpret_cast<const uint8_t *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if(mapping)
+            CloseHandle(mapping);
+        if(!view) {
+            CloseHandle(file);
+            length = 0;
+            return false;
+        }
+    }
+
+    CloseHandle(file);
+#else
+    const int fd = ::open(full_path.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    length = static_cast<size_t>(st.st_size);
+    if(length) {
+        void *ptr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if(ptr == MAP_FAILED) {
+            ::close(fd);
+            length = 0;
+            return false;
+        }
+
+        view = reinterpret_cast<const uint8_t *>(ptr);
+    }
+
+    ::close(fd);
+#endif
+
+    opened = true;
+    return true;
+}
+
+void fs::MappedFile::close()
+{
+    if(view) {
+#if defined(_WIN32)
+        UnmapViewOfFile(view);
+#else
+        munmap(const_cast<uint8_t *>(view), length);
+#endif
+    }
+
+    opened = false;
+    view = nullptr;
+    length = 0;
+}
@@ -12,15 +12,57 @@
 namespace stdfs = std::filesystem;
 namespace fs
 {
+// Read-only memory-mapped view of a file.
+// The view stays valid until close() or until
+// the object is destroyed; the file itself may
+// be written to meanwhile but not truncated.
+class MappedFile final {
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile &&rhs);
+    MappedFile(const MappedFile &rhs) = delete;
+    MappedFile &operator=(MappedFile &&rhs);
+    MappedFile &operator=(const MappedFile &rhs) = delete;
+    ~MappedFile();
+
+    bool open(const stdfs::path &path);
+    void close();
+
+    inline bool isOpen() const
+    {
+        return opened;
+    }
+
+    inline const uint8_t *data() const
+    {
+        return view;
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+
+private:
+    bool opened { false };
+    const uint8_t *view { nullptr };
+    size_t length { 0 };
+};
+
 void init();
 void shutdown();
 bool setRoot(const stdfs::path &path);
 void mount(const stdfs::path &path);
 bool exists(const stdfs::path &path);
 bool readBytes(const stdfs::path &path, std::vector<uint8_t> &buffer);
+size_t readBytes(const stdfs::path &path, void *buffer, size_t size);
 bool writeBytes(const stdfs::path &path, const std::vector<uint8_t> &buffer);
 bool readText(const stdfs::path &path, std::string &buffer);
 bool writeText(const stdfs::path &path, const std::string &buffer);
+
+// Makes the written contents of the file survive
+// a power loss (fsync). The path is used as is.
+bool syncFile(const stdfs::path &path);
 const stdfs::path getFullPath(stdfs::path path);
 const stdfs::path getWritePath(stdfs::path path);
 } // namespace fs
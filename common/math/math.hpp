@@ -63,6 +63,12 @@ constexpr static inline const T clamp(const T x, const T min, const T max)
     return x;
 }
 
+template<typename T>
+constexpr static inline const T lerp(const T a, const T b, const T t)
+{
+    return a + (b - a) * t;
+}
+
 static inline const float wrapAngle180N(const float angle)
 {
     const float wrap = glm::mod(angle + ANGLE_180D, ANGLE_360D);
@@ -0,0 +1,249 @@
+/*
+ * noise.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <array>
+#include <cmath>
+#include <common/math/noise.hpp>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PERLIN_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PERLIN_SSE2 1
+#endif
+
+constexpr static const size_t PERLIN_PERIOD = 289;
+
+// Gradients depend only on the corner hash which is
+// an integer in [0, 289). They are computed once in
+// double exactly the way glm does it: in float the
+// sign tests below can flip for some of the hashes.
+struct GradientTable final {
+    std::array<float, PERLIN_PERIOD> x, y, z;
+
+    GradientTable()
+    {
+        for(size_t i = 0; i < PERLIN_PERIOD; i++) {
+            double gx = static_cast<double>(i) * (1.0 / 7.0);
+            double gy = (std::floor(gx) * (1.0 / 7.0) - std::floor(std::floor(gx) * (1.0 / 7.0))) - 0.5;
+            gx = gx - std::floor(gx);
+            const double gz = 0.5 - std::abs(gx) - std::abs(gy);
+            const double sz = (gz <= 0.0) ? 1.0 : 0.0;
+            gx -= sz * (((gx < 0.0) ? 0.0 : 1.0) - 0.5);
+            gy -= sz * (((gy < 0.0) ? 0.0 : 1.0) - 0.5);
+
+            const double norm = 1.79284291400159 - 0.85373472095314 * (gx * gx + gy * gy + gz * gz);
+            x[i] = static_cast<float>(gx * norm);
+            y[i] = static_cast<float>(gy * norm);
+            z[i] = static_cast<float>(gz * norm);
+        }
+    }
+};
+
+static const GradientTable gradients;
+
+struct ScalarLanes final {
+    using type = float;
+    constexpr static const size_t width = 1;
+
+    static inline float load(const float *p) { return *p; }
+    static inline void store(float *p, float v) { *p = v; }
+    static inline float set(float v) { return v; }
+    static inline float add(float a, float b) { return a + b; }
+    static inline float sub(float a, float b) { return a - b; }
+    static inline float mul(float a, float b) { return a * b; }
+    static inline float floor(float v) { return std::floor(v); }
+
+    static inline void gather(float h, float &gx, float &gy, float &gz)
+    {
+        const size_t i = static_cast<size_t>(h);
+        gx = gradients.x[i];
+        gy = gradients.y[i];
+        gz = gradients.z[i];
+    }
+};
+
+#if defined(PERLIN_AVX2)
+struct VectorLanes final {
+    using type = __m256;
+    constexpr static const size_t width = 8;
+
+    static inline __m256 load(const float *p) { return _mm256_loadu_ps(p); }
+    static inline void store(float *p, __m256 v) { _mm256_storeu_ps(p, v); }
+    static inline __m256 set(float v) { return _mm256_set1_ps(v); }
+    static inline __m256 add(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+    static inline __m256 sub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+    static inline __m256 mul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+    static inline __m256 floor(__m256 v) { return _mm256_floor_ps(v); }
+
+    static inline void gather(__m256 h, __m256 &gx, __m256 &gy, __m256 &gz)
+    {
+        const __m256i i = _mm256_cvttps_epi32(h);
+        gx = _mm256_i32gather_ps(gradients.x.data(), i, 4);
+        gy = _mm256_i32gather_ps(gradients.y.data(), i, 4);
+        gz = _mm256_i32gather_ps(gradients.z.data(), i, 4);
+    }
+};
+#elif defined(PERLIN_SSE2)
+struct VectorLanes final {
+    using type = __m128;
+    constexpr static const size_t width = 4;
+
+    static inline __m128 load(const float *p) { return _mm_loadu_ps(p); }
+    static inline void store(float *p, __m128 v) { _mm_storeu_ps(p, v); }
+    static inline __m128 set(float v) { return _mm_set1_ps(v); }
+    static inline __m128 add(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+    static inline __m128 sub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+    static inline __m128 mul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+
+    static inline __m128 floor(__m128 v)
+    {
+        // No roundps in SSE2: truncate and fix up
+        // the negative values. Inputs are small.
+        const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1.0f)));
+    }
+
+    static inline void gather(__m128 h, __m128 &gx, __m128 &gy, __m128 &gz)
+    {
+        alignas(16) int32_t i[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(i), _mm_cvttps_epi32(h));
+        gx = _mm_setr_ps(gradients.x[i[0]], gradients.x[i[1]], gradients.x[i[2]], gradients.x[i[3]]);
+        gy = _mm_setr_ps(gradients.y[i[0]], gradients.y[i[1]], gradients.y[i[2]], gradients.y[i[3]]);
+        gz = _mm_setr_ps(gradients.z[i[0]], gradients.z[i[1]], gradients.z[i[2]], gradients.z[i[3]]);
+    }
+};
+#else
+using VectorLanes = ScalarLanes;
+#endif
+
+template<typename L>
+static inline typename L::type mod289(typename L::type v)
+{
+    // Exact in float: the arguments never exceed 2^24
+    return L::sub(v, L::mul(L::floor(L::mul(v, L::set(1.0f / 289.0f))), L::set(289.0f)));
+}
+
+template<typename L>
+static inline typename L::type permute(typename L::type v)
+{
+    return mod289<L>(L::mul(L::add(L::mul(v, L::set(34.0f)), L::set(1.0f)), v));
+}
+
+template<typename L>
+static inline typename L::type fade(typename L::type t)
+{
+    // t * t * t * (t * (t * 6 - 15) + 10)
+    const typename L::type p = L::add(L::mul(t, L::sub(L::mul(t, L::set(6.0f)), L::set(15.0f))), L::set(10.0f));
+    return L::mul(L::mul(L::mul(t, t), t), p);
+}
+
+template<typename L>
+static inline typename L::type mix(typename L::type a, typename L::type b, typename L::type t)
+{
+    return L::add(a, L::mul(t, L::sub(b, a)));
+}
+
+template<typename L>
+static inline typename L::type corner(typename L::type h, typename L::type fx, typename L::type fy, typename L::type fz)
+{
+    typename L::type gx, gy, gz;
+    L::gather(h, gx, gy, gz);
+    return L::add(L::add(L::mul(gx, fx), L::mul(gy, fy)), L::mul(gz, fz));
+}
+
+template<typename L>
+static inline typename L::type perlinKernel(typename L::type x, typename L::type y, typename L::type z)
+{
+    using V = typename L::type;
+    const V one = L::set(1.0f);
+
+    const V i0x = L::floor(x);
+    const V i0y = L::floor(y);
+    const V i0z = L::floor(z);
+    const V f0x = L::sub(x, i0x);
+    const V f0y = L::sub(y, i0y);
+    const V f0z = L::sub(z, i0z);
+    const V f1x = L::sub(f0x, one);
+    const V f1y = L::sub(f0y, one);
+    const V f1z = L::sub(f0z, one);
+    const V p0x = mod289<L>(i0x);
+    const V p0y = mod289<L>(i0y);
+    const V p0z = mod289<L>(i0z);
+    const V p1x = mod289<L>(L::add(i0x, one));
+    const V p1y = mod289<L>(L::add(i0y, one));
+    const V p1z = mod289<L>(L::add(i0z, one));
+
+    const V hx0 = permute<L>(p0x);
+    const V hx1 = permute<L>(p1x);
+    const V h00 = permute<L>(L::add(hx0, p0y));
+    const V h10 = permute<L>(L::add(hx1, p0y));
+    const V h01 = permute<L>(L::add(hx0, p1y));
+    const V h11 = permute<L>(L::add(hx1, p1y));
+
+    const V n000 = corner<L>(permute<L>(L::add(h00, p0z)), f0x, f0y, f0z);
+    const V n100 = corner<L>(permute<L>(L::add(h10, p0z)), f1x, f0y, f0z);
+    const V n010 = corner<L>(permute<L>(L::add(h01, p0z)), f0x, f1y, f0z);
+    const V n110 = corner<L>(permute<L>(L::add(h11, p0z)), f1x, f1y, f0z);
+    const V n001 = corner<L>(permute<L>(L::add(h00, p1z)), f0x, f0y, f1z);
+    const V n101 = corner<L>(permute<L>(L::add(h10, p1z)), f1x, f0y, f1z);
+    const V n011 = corner<L>(permute<L>(L::add(h01, p1z)), f0x, f1y, f1z);
+    const V n111 = corner<L>(permute<L>(L::add(h11, p1z)), f1x, f1y, f1z);
+
+    const V ux = fade<L>(f0x);
+    const V uy = fade<L>(f0y);
+    const V uz = fade<L>(f0z);
+    const V n00 = mix<L>(n000, n001, uz);
+    const V n10 = mix<L>(n100, n101, uz);
+    const V n01 = mix<L>(n010, n011, uz);
+    const V n11 = mix<L>(n110, n111, uz);
+    const V n0 = mix<L>(n00, n01, uy);
+    const V n1 = mix<L>(n10, n11, uy);
+    return L::mul(L::set(2.2f), mix<L>(n0, n1, ux));
+}
+
+void math::perlin(const float *x, const float *y, const float *z, float *out, size_t count)
+{
+    size_t i = 0;
+    for(; i + VectorLanes::width <= count; i += VectorLanes::width)
+        VectorLanes::store(out + i, perlinKernel<VectorLanes>(VectorLanes::load(x + i), VectorLanes::load(y + i), VectorLanes::load(z + i)));
+    for(; i < count; i++)
+        out[i] = perlinKernel<ScalarLanes>(x[i], y[i], z[i]);
+}
+
+void math::perlinGrid(const double3 &origin, const double3 &step, size_t nx, size_t ny, size_t nz, float *out)
+{
+    // The noise repeats every 289 units so moving
+    // the origin close to zero keeps float precision.
+    const double period = static_cast<double>(PERLIN_PERIOD);
+    const double3 base = origin - glm::floor(origin / period) * period;
+
+    const size_t count = nx * ny * nz;
+    std::vector<float> x(count), y(count), z(count);
+    for(size_t ix = 0, i = 0; ix < nx; ix++) {
+        for(size_t iz = 0; iz < nz; iz++) {
+            for(size_t iy = 0; iy < ny; iy++, i++) {
+                x[i] = static_cast<float>(base.x + step.x * static_cast<double>(ix));
+                y[i] = static_cast<float>(base.y + step.y * static_cast<double>(iy));
+                z[i] = static_cast<float>(base.z + step.z * static_cast<double>(iz));
+            }
+        }
+    }
+
+    math::perlin(x.data(), y.data(), z.data(), out, count);
+}
+
+const char *math::getPerlinBackend()
+{
+#if defined(PERLIN_AVX2)
+    return "AVX2";
+#elif defined(PERLIN_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
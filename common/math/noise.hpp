@@ -0,0 +1,28 @@
+/*
+ * noise.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <common/math/types.hpp>
+
+namespace math
+{
+// Largest absolute difference from glm::perlin(double3)
+// at the same points. The batched kernel works in float
+// but the input is reduced by the noise period (289) in
+// double first, so the error doesn't grow with distance.
+constexpr static const float PERLIN_TOLERANCE = 1.0e-4f;
+
+// Classic 3D Perlin noise: the same function glm::perlin()
+// computes, evaluated for a batch of points with AVX2 or
+// SSE2 lanes when the compiler targets them.
+void perlin(const float *x, const float *y, const float *z, float *out, size_t count);
+
+// Samples the noise at origin + step * (ix, iy, iz) and
+// stores the results in the x-z-y order voxels use:
+// out[(ix * nz + iz) * ny + iy].
+void perlinGrid(const double3 &origin, const double3 &step, size_t nx, size_t ny, size_t nz, float *out);
+
+const char *getPerlinBackend();
+} // namespace math
@@ -41,7 +41,7 @@ int main(int argc, char **argv)
 #if defined(VGAME_CLIENT)
     client_app::run();
 #elif defined(VGAME_SERVER)
-    server_app::run();
+    server_app::run(argc, argv);
 #else
     #error No side defined
 #endif
@@ -0,0 +1,72 @@
+/*
+ * autosave.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <common/math/math.hpp>
+#include <common/util/clock.hpp>
+#include <server/autosave.hpp>
+#include <server/chunks.hpp>
+#include <server/config.hpp>
+#include <server/globals.hpp>
+#include <spdlog/spdlog.h>
+
+static AutosaveStats stats = {};
+static float quota = 0.0f;
+static ChronoClock<std::chrono::steady_clock> log_clock;
+
+void sv_autosave::update()
+{
+    const std::chrono::microseconds budget = std::chrono::microseconds(globals::config.autosave.budget_us);
+    const std::chrono::duration<float> period = std::chrono::duration<float>(globals::config.autosave.period);
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    // Spread the currently dirty chunks evenly over
+    // the period instead of saving them in bursts.
+    stats.pending = globals::chunks.getDirtyCount();
+    quota = math::min(quota + static_cast<float>(stats.pending) * globals::ticktime / period.count(), static_cast<float>(stats.pending));
+
+    ChronoClock<std::chrono::steady_clock> clock;
+    std::chrono::steady_clock::time_point since;
+    while(globals::chunks.getOldestDirty(since)) {
+        // Chunks older than the period are overdue
+        // and are saved regardless of the pacing.
+        if(quota < 1.0f && now - since < period)
+            break;
+
+        if(clock.elapsed() >= budget) {
+            if(now - since >= period)
+                stats.overruns++;
+            break;
+        }
+
+        std::chrono::steady_clock::duration lag;
+        if(!globals::chunks.saveOldest(lag))
+            break;
+
+        quota = math::max(quota - 1.0f, 0.0f);
+        stats.saved++;
+        stats.avg_lag += (std::chrono::duration<float>(lag).count() - stats.avg_lag) * 0.05f;
+    }
+
+    stats.pending = globals::chunks.getDirtyCount();
+    if(globals::chunks.getOldestDirty(since))
+        stats.max_lag = std::chrono::duration<float>(now - since).count();
+    else
+        stats.max_lag = 0.0f;
+
+    if(log_clock.elapsed() >= period) {
+        logStats();
+        log_clock.restart();
+    }
+}
+
+void sv_autosave::logStats()
+{
+    spdlog::info("Autosave: {} saved, {} pending, lag {:.1f} s avg, {:.1f} s max, {} overruns", stats.saved, stats.pending, stats.avg_lag, stats.max_lag, stats.overruns);
+}
+
+const AutosaveStats &sv_autosave::getStats()
+{
+    return stats;
+}
@@ -0,0 +1,28 @@
+/*
+ * autosave.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <stddef.h>
+
+struct AutosaveStats final {
+    size_t pending;     // Dirty chunks waiting to be saved
+    size_t saved;       // Chunks saved since startup
+    size_t overruns;    // Ticks that ran out of budget with overdue chunks left
+    float avg_lag;      // Average time a change waits to be saved, seconds
+    float max_lag;      // Age of the oldest unsaved change, seconds
+};
+
+// Saves dirty chunks in the background of the main
+// loop. Each tick spends at most autosave.budget_us
+// microseconds and the pace is chosen so that every
+// change is saved within autosave.period seconds.
+namespace sv_autosave
+{
+void update();
+void logStats();
+const AutosaveStats &getStats();
+} // namespace sv_autosave
+
+namespace autosave = sv_autosave;
@@ -0,0 +1,96 @@
+/*
+ * bench.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <algorithm>
+#include <cmath>
+#include <common/math/noise.hpp>
+#include <common/util/clock.hpp>
+#include <glm/gtc/noise.hpp>
+#include <server/bench.hpp>
+#include <server/chunks.hpp>
+#include <server/dgen.hpp>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+constexpr static const size_t BLOCK_SIZE = 16;
+constexpr static const size_t BLOCK_VOLUME = BLOCK_SIZE * BLOCK_SIZE * BLOCK_SIZE;
+constexpr static const size_t NUM_BLOCKS = 512;
+
+static void benchNoise()
+{
+    const double3 step = double3(1.0 / 64.0, 1.0 / 32.0, 1.0 / 64.0);
+    std::vector<float> scalar(NUM_BLOCKS * BLOCK_VOLUME);
+    std::vector<float> batched(NUM_BLOCKS * BLOCK_VOLUME);
+
+    ChronoClock<std::chrono::steady_clock> clock;
+    for(size_t b = 0, i = 0; b < NUM_BLOCKS; b++) {
+        const double3 origin = double3(b * 1.5, 0.25, b * -2.5);
+        for(size_t x = 0; x < BLOCK_SIZE; x++) {
+            for(size_t z = 0; z < BLOCK_SIZE; z++) {
+                for(size_t y = 0; y < BLOCK_SIZE; y++)
+                    scalar[i++] = static_cast<float>(glm::perlin(origin + step * double3(x, y, z)));
+            }
+        }
+    }
+
+    const float scalar_time = util::seconds<float>(clock.restart());
+
+    for(size_t b = 0; b < NUM_BLOCKS; b++) {
+        const double3 origin = double3(b * 1.5, 0.25, b * -2.5);
+        math::perlinGrid(origin, step, BLOCK_SIZE, BLOCK_SIZE, BLOCK_SIZE, batched.data() + b * BLOCK_VOLUME);
+    }
+
+    const float batched_time = util::seconds<float>(clock.elapsed());
+
+    float error = 0.0f;
+    for(size_t i = 0; i < scalar.size(); i++)
+        error = std::max(error, std::abs(scalar[i] - batched[i]));
+
+    const float samples = static_cast<float>(scalar.size());
+    spdlog::info("perlin: glm::perlin(double3): {:.2f} Msamples/s", samples / scalar_time * 1.0e-6f);
+    spdlog::info("perlin: math::perlinGrid ({}): {:.2f} Msamples/s", math::getPerlinBackend(), samples / batched_time * 1.0e-6f);
+    spdlog::info("perlin: max error {} (tolerance {})", error, math::PERLIN_TOLERANCE);
+}
+
+static void benchDensity()
+{
+    constexpr const int32_t RADIUS = 6;
+
+    for(const int lattice : { 1, 4 }) {
+        WorldConfig config;
+        config.base = -RADIUS;
+        config.height = RADIUS * 2;
+        config.generator.seed = 42;
+        config.toml = toml::table {{
+            { "generator", toml::table {{
+                { "dgen_lattice", lattice }
+            }}}
+        }};
+
+        DGen dgen;
+        dgen.init(config);
+
+        size_t count = 0;
+        VoxelStorage data;
+        ChronoClock<std::chrono::steady_clock> clock;
+        for(int32_t x = -RADIUS; x < RADIUS; x++) {
+            for(int32_t y = -RADIUS; y < RADIUS; y++) {
+                for(int32_t z = -RADIUS; z < RADIUS; z++) {
+                    dgen.generate(chunkpos_t(x, y, z), data);
+                    count++;
+                }
+            }
+        }
+
+        const float seconds = util::seconds<float>(clock.elapsed());
+        spdlog::info("dgen: lattice {}: {:.2f} Mvoxels/s ({} chunks)", lattice, static_cast<float>(count * CHUNK_VOLUME) / seconds * 1.0e-6f, count);
+    }
+}
+
+void sv_bench::run()
+{
+    benchNoise();
+    benchDensity();
+}
@@ -0,0 +1,15 @@
+/*
+ * bench.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+
+// World generation benchmarks, run with
+// "vgameds --bench" instead of the server.
+namespace sv_bench
+{
+void run();
+} // namespace sv_bench
+
+namespace bench = sv_bench;
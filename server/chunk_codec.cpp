@@ -0,0 +1,123 @@
+/*
+ * chunk_codec.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <common/math/crc64.hpp>
+#include <server/chunk_codec.hpp>
+#include <shared/voxel_rle.hpp>
+
+// Chunk record layout (little endian):
+//  uint32_t magic
+//  uint8_t  version
+//  uint8_t  encoding
+//  uint16_t reserved
+//  uint32_t uncompressed size
+//  uint32_t payload size
+//  uint64_t payload CRC64
+//  uint8_t  payload[]
+constexpr static const uint32_t CHUNK_MAGIC = 0x4B435856; // 'VXCK'
+constexpr static const uint8_t CHUNK_VERSION = 1;
+constexpr static const size_t CHUNK_HEADER_SIZE = 24;
+
+constexpr static const uint8_t CHUNK_ENCODING_RAW = 0x00;
+constexpr static const uint8_t CHUNK_ENCODING_RLE = 0x01;
+constexpr static const uint8_t CHUNK_ENCODING_UNIFORM = 0x02;
+
+template<typename T>
+static inline void putValue(uint8_t *p, T value)
+{
+    for(size_t i = 0; i < sizeof(T); i++)
+        p[i] = static_cast<uint8_t>(value >> (i * 8));
+}
+
+template<typename T>
+static inline const T getValue(const uint8_t *p)
+{
+    T value = 0;
+    for(size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<T>(p[i]) << (i * 8);
+    return value;
+}
+
+void chunk_codec::encode(const VoxelStorage &data, std::vector<uint8_t> &buffer)
+{
+    voxel_array_t array;
+    uint8_t encoding = CHUNK_ENCODING_RLE;
+    buffer.assign(CHUNK_HEADER_SIZE, 0);
+
+    if(data.isUniform()) {
+        // Solid underground, empty sky
+        encoding = CHUNK_ENCODING_UNIFORM;
+        buffer.push_back(static_cast<uint8_t>(data.getUniform()));
+    }
+    else {
+        data.unpack(array);
+        voxel_rle::encode(array, buffer);
+    }
+
+    if(encoding == CHUNK_ENCODING_RLE && buffer.size() - CHUNK_HEADER_SIZE >= sizeof(voxel_t) * CHUNK_VOLUME) {
+        // Noise doesn't compress
+        encoding = CHUNK_ENCODING_RAW;
+        buffer.resize(CHUNK_HEADER_SIZE);
+        buffer.insert(buffer.end(), array.cbegin(), array.cend());
+    }
+
+    const size_t payload_size = buffer.size() - CHUNK_HEADER_SIZE;
+    putValue<uint32_t>(&buffer[0], CHUNK_MAGIC);
+    putValue<uint8_t>(&buffer[4], CHUNK_VERSION);
+    putValue<uint8_t>(&buffer[5], encoding);
+    putValue<uint16_t>(&buffer[6], 0);
+    putValue<uint32_t>(&buffer[8], static_cast<uint32_t>(sizeof(voxel_t) * CHUNK_VOLUME));
+    putValue<uint32_t>(&buffer[12], static_cast<uint32_t>(payload_size));
+    putValue<uint64_t>(&buffer[16], math::crc64(buffer.data() + CHUNK_HEADER_SIZE, payload_size));
+}
+
+bool chunk_codec::decode(const uint8_t *buffer, size_t size, VoxelStorage &data)
+{
+    voxel_array_t array;
+
+    if(size < CHUNK_HEADER_SIZE || getValue<uint32_t>(buffer) != CHUNK_MAGIC) {
+        // Chunks written before the record format
+        // existed are headerless raw voxel dumps.
+        if(size != sizeof(voxel_t) * CHUNK_VOLUME)
+            return false;
+        std::copy(buffer, buffer + size, reinterpret_cast<uint8_t *>(array.data()));
+        data.assign(array);
+        return true;
+    }
+
+    const uint8_t version = getValue<uint8_t>(buffer + 4);
+    const uint8_t encoding = getValue<uint8_t>(buffer + 5);
+    const uint32_t uncompressed_size = getValue<uint32_t>(buffer + 8);
+    const uint32_t payload_size = getValue<uint32_t>(buffer + 12);
+    const uint64_t checksum = getValue<uint64_t>(buffer + 16);
+    const uint8_t *payload = buffer + CHUNK_HEADER_SIZE;
+
+    if(version != CHUNK_VERSION || uncompressed_size != sizeof(voxel_t) * CHUNK_VOLUME)
+        return false;
+    if(payload_size > size - CHUNK_HEADER_SIZE || math::crc64(payload, payload_size) != checksum)
+        return false;
+
+    switch(encoding) {
+        case CHUNK_ENCODING_RAW:
+            if(payload_size != uncompressed_size)
+                return false;
+            std::copy(payload, payload + payload_size, reinterpret_cast<uint8_t *>(array.data()));
+            break;
+        case CHUNK_ENCODING_RLE:
+            if(!voxel_rle::decode(payload, payload_size, array))
+                return false;
+            break;
+        case CHUNK_ENCODING_UNIFORM:
+            if(payload_size != sizeof(voxel_t))
+                return false;
+            data.fill(static_cast<voxel_t>(payload[0]));
+            return true;
+        default:
+            return false;
+    }
+
+    data.assign(array);
+    return true;
+}
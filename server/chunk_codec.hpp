@@ -0,0 +1,13 @@
+/*
+ * chunk_codec.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <shared/voxel_storage.hpp>
+
+namespace chunk_codec
+{
+void encode(const VoxelStorage &data, std::vector<uint8_t> &buffer);
+bool decode(const uint8_t *buffer, size_t size, VoxelStorage &data);
+} // namespace chunk_codec
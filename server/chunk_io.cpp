@@ -0,0 +1,256 @@
+/*
+ * chunk_io.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <server/chunk_codec.hpp>
+#include <server/chunk_io.hpp>
+#include <spdlog/spdlog.h>
+
+void ChunkIO::init(const stdfs::path &dir, uint64_t generator_key)
+{
+    storage.init(dir);
+    empty_index.init(dir, generator_key);
+
+    // Nobody else touches the storage yet
+    // so we can migrate the old stuff here.
+    if(const size_t count = storage.migrate(dir.parent_path() / "chunks"))
+        spdlog::info("Migrated {} chunks to region files", count);
+
+    running = true;
+    thread = std::thread(&ChunkIO::threadFunc, this);
+}
+
+void ChunkIO::shutdown()
+{
+    {
+        std::scoped_lock lock(mutex);
+        running = false;
+    }
+
+    cv.notify_all();
+    if(thread.joinable())
+        thread.join();
+
+    storage.shutdown();
+    empty_index.shutdown();
+    requests.clear();
+    results.clear();
+    failed_writes.clear();
+}
+
+void ChunkIO::read(const chunkpos_t &cp)
+{
+    submit(ChunkIORequest { ChunkIORequestType::READ, cp, {} });
+}
+
+void ChunkIO::write(const chunkpos_t &cp, std::vector<uint8_t> &&buffer)
+{
+    submit(ChunkIORequest { ChunkIORequestType::WRITE, cp, std::move(buffer) });
+}
+
+void ChunkIO::writeBatch(std::vector<std::pair<chunkpos_t, std::vector<uint8_t>>> &&batch)
+{
+    ChunkIORequest request = {};
+    request.type = ChunkIORequestType::WRITE_BATCH;
+    request.batch = std::move(batch);
+    submit(std::move(request));
+}
+
+void ChunkIO::checkpoint(uint64_t id)
+{
+    ChunkIORequest request = {};
+    request.type = ChunkIORequestType::CHECKPOINT;
+    request.checkpoint = id;
+    submit(std::move(request));
+}
+
+void ChunkIO::markEmpty(const chunkpos_t &cp)
+{
+    submit(ChunkIORequest { ChunkIORequestType::MARK_EMPTY, cp, {} });
+}
+
+void ChunkIO::unmarkEmpty(const chunkpos_t &cp)
+{
+    submit(ChunkIORequest { ChunkIORequestType::UNMARK_EMPTY, cp, {} });
+}
+
+void ChunkIO::flush()
+{
+    submit(ChunkIORequest { ChunkIORequestType::FLUSH, chunkpos_t(0, 0, 0), {} });
+}
+
+bool ChunkIO::poll(ChunkIOResult &result)
+{
+    std::scoped_lock lock(mutex);
+    if(results.empty())
+        return false;
+    result = std::move(results.front());
+    results.pop_front();
+    return true;
+}
+
+bool ChunkIO::pollFailed(chunkpos_t &cp)
+{
+    std::scoped_lock lock(mutex);
+    if(failed_writes.empty())
+        return false;
+    cp = failed_writes.front();
+    failed_writes.pop_front();
+    return true;
+}
+
+size_t ChunkIO::getQueueSize() const
+{
+    std::scoped_lock lock(mutex);
+    return requests.size();
+}
+
+size_t ChunkIO::getWriteCount() const
+{
+    return write_count.load();
+}
+
+uint64_t ChunkIO::getCheckpoint() const
+{
+    return last_checkpoint.load();
+}
+
+uint64_t ChunkIO::getFailedCheckpoint() const
+{
+    return failed_checkpoint.load();
+}
+
+void ChunkIO::submit(ChunkIORequest &&request)
+{
+    {
+        std::scoped_lock lock(mutex);
+        requests.push_back(std::move(request));
+    }
+
+    cv.notify_one();
+}
+
+bool ChunkIO::writeChunk(const chunkpos_t &cp, const std::vector<uint8_t> &buffer)
+{
+    if(storage.write(cp, buffer)) {
+        unwritten.erase(cp);
+        return true;
+    }
+
+    spdlog::warn("Unable to write chunk [{}, {}, {}]", cp.x, cp.y, cp.z);
+    unwritten[cp] = buffer;
+
+    std::scoped_lock lock(mutex);
+    failed_writes.push_back(cp);
+    return false;
+}
+
+void ChunkIO::threadFunc()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;) {
+        cv.wait(lock, [this]() { return !requests.empty() || !running; });
+
+        // Drain the queue before exiting so the
+        // writes submitted on shutdown hit the disk.
+        if(requests.empty())
+            break;
+
+        ChunkIORequest request = std::move(requests.front());
+        requests.pop_front();
+        lock.unlock();
+
+        switch(request.type) {
+            case ChunkIORequestType::READ: {
+                size_t size;
+                const uint8_t *data;
+                ChunkIOResult result = {};
+                result.position = request.position;
+
+                // The region file has stale data
+                const auto it = unwritten.find(request.position);
+                if(it != unwritten.cend()) {
+                    data = it->second.data();
+                    size = it->second.size();
+                    result.found = true;
+                }
+                else {
+                    result.found = storage.read(request.position, data, size);
+                }
+
+                if(result.found && !chunk_codec::decode(data, size, result.data)) {
+                    spdlog::warn("Chunk [{}, {}, {}] is corrupted", request.position.x, request.position.y, request.position.z);
+                    result.found = false;
+                }
+
+                result.empty = !result.found && empty_index.get(request.position);
+
+                lock.lock();
+                results.push_back(std::move(result));
+                continue;
+            }
+
+            case ChunkIORequestType::WRITE:
+                writeChunk(request.position, request.buffer);
+                write_count++;
+                break;
+
+            case ChunkIORequestType::WRITE_BATCH:
+                for(const auto &it : request.batch) {
+                    writeChunk(it.first, it.second);
+                    write_count++;
+                }
+
+                storage.flush();
+                break;
+
+            case ChunkIORequestType::FLUSH:
+                storage.flush();
+                empty_index.flush();
+                break;
+
+            case ChunkIORequestType::CHECKPOINT: {
+                // A failure only fails the checkpoint that
+                // follows it as long as a retry succeeds.
+                bool failed = !retryUnwritten();
+                if(!storage.sync()) {
+                    spdlog::warn("Unable to sync region files");
+                    failed = true;
+                }
+
+                empty_index.flush();
+                if(failed)
+                    failed_checkpoint = request.checkpoint;
+                last_checkpoint = request.checkpoint;
+                break;
+            }
+
+            case ChunkIORequestType::MARK_EMPTY:
+                empty_index.set(request.position, true);
+                break;
+
+            case ChunkIORequestType::UNMARK_EMPTY:
+                empty_index.set(request.position, false);
+                break;
+        }
+
+        lock.lock();
+    }
+
+    if(!retryUnwritten())
+        spdlog::error("{} chunks could not be written", unwritten.size());
+    storage.sync();
+    empty_index.flush();
+}
+
+bool ChunkIO::retryUnwritten()
+{
+    // writeChunk() erases the entry on success
+    std::vector<chunkpos_t> positions;
+    for(const auto &it : unwritten)
+        positions.push_back(it.first);
+    for(const chunkpos_t &cp : positions)
+        writeChunk(cp, std::vector<uint8_t>(unwritten.at(cp)));
+    return unwritten.empty();
+}
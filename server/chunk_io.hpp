@@ -0,0 +1,113 @@
+/*
+ * chunk_io.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <server/empty_index.hpp>
+#include <server/region.hpp>
+#include <shared/voxel_storage.hpp>
+#include <thread>
+#include <unordered_map>
+
+enum class ChunkIORequestType {
+    READ,
+    WRITE,
+    WRITE_BATCH,
+    FLUSH,
+    CHECKPOINT,
+    MARK_EMPTY,
+    UNMARK_EMPTY
+};
+
+struct ChunkIORequest final {
+    ChunkIORequestType type;
+    chunkpos_t position;
+    std::vector<uint8_t> buffer;
+    std::vector<std::pair<chunkpos_t, std::vector<uint8_t>>> batch;
+    uint64_t checkpoint;
+};
+
+struct ChunkIOResult final {
+    chunkpos_t position;
+    bool found;
+    bool empty;
+    VoxelStorage data;
+};
+
+// Owns the region storage and performs all the disk
+// access on a dedicated thread. Requests are served
+// strictly in submission order so a read that follows
+// a write of the same chunk always sees the new data.
+// Chunks are decoded on the same thread straight from
+// the memory-mapped region file. Reads of chunks that
+// are not stored consult the known-empty index. Chunks
+// that failed to write are kept in memory, served to
+// reads and written again at each checkpoint.
+class ChunkIO final : public NonCopyable {
+public:
+    void init(const stdfs::path &dir, uint64_t generator_key);
+    void shutdown();
+
+    void read(const chunkpos_t &cp);
+    void write(const chunkpos_t &cp, std::vector<uint8_t> &&buffer);
+    void flush();
+
+    // Writes a group of chunks in one go. Meant for
+    // chunks of the same region: the region file is
+    // opened once and flushed once after the batch.
+    // Safe to call from any thread.
+    void writeBatch(std::vector<std::pair<chunkpos_t, std::vector<uint8_t>>> &&batch);
+
+    // Flushes the storage after all the requests that
+    // were submitted before it; getCheckpoint() returns
+    // the ID of the last checkpoint that was reached.
+    // getFailedCheckpoint() returns the ID of the last
+    // one that failed: some chunks could not be written
+    // even when tried again or the storage failed to sync.
+    void checkpoint(uint64_t id);
+
+    void markEmpty(const chunkpos_t &cp);
+    void unmarkEmpty(const chunkpos_t &cp);
+
+    // Called from the main thread to
+    // collect completed read requests.
+    bool poll(ChunkIOResult &result);
+
+    // Called from the main thread to collect
+    // the positions of chunks that failed to write.
+    bool pollFailed(chunkpos_t &cp);
+
+    size_t getQueueSize() const;
+
+    // Total number of chunk writes processed
+    // by the I/O thread, failed ones included.
+    size_t getWriteCount() const;
+    uint64_t getCheckpoint() const;
+    uint64_t getFailedCheckpoint() const;
+
+private:
+    void submit(ChunkIORequest &&request);
+    bool writeChunk(const chunkpos_t &cp, const std::vector<uint8_t> &buffer);
+    bool retryUnwritten();
+    void threadFunc();
+
+private:
+    bool running { false };
+    std::atomic<size_t> write_count { 0 };
+    std::atomic<uint64_t> last_checkpoint { 0 };
+    std::atomic<uint64_t> failed_checkpoint { 0 };
+    std::unordered_map<chunkpos_t, std::vector<uint8_t>> unwritten;
+    RegionStorage storage;
+    EmptyIndex empty_index;
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<ChunkIORequest> requests;
+    std::deque<ChunkIOResult> results;
+    std::deque<chunkpos_t> failed_writes;
+};
@@ -3,22 +3,31 @@
  * Copyright (c) 2021, Kirill GPRB.
  * All Rights Reserved.
  */
+#include <algorithm>
 #include <common/filesystem.hpp>
 #include <common/math/crc64.hpp>
 #include <common/math/random.hpp>
 #include <common/util/clock.hpp>
+#include <server/chunk_codec.hpp>
 #include <server/chunks.hpp>
+#include <server/config.hpp>
 #include <server/globals.hpp>
+#include <server/network.hpp>
 #include <shared/components/chunk.hpp>
 #include <spdlog/fmt/fmt.h>
-#include <server/vgen.hpp>
 #include <sstream>
+#include <thread_pool.hpp>
+
+// Shared by world generation and saving
+static thread_pool world_threads;
 
 void WorldConfig::implPostRead()
 {
     base = toml["base"].value_or(0);
     height = toml["height"].value_or(2);
+    save_generated = toml["save_generated"].value_or(true);
     generator.seed = math::crc64(toml["generator"]["seed"].value_or("0"));
+    generator.use = toml["generator"]["use"].value_or("vgen");
     spdlog::info("seed = {}", generator.seed);
 }
 
@@ -30,25 +39,58 @@ void WorldConfig::implPreWrite()
     toml = toml::table {{
         { "base", base },
         { "height", height },
+        { "save_generated", save_generated },
         { "generator", toml::table {{
-            { "seed", math::randomString(rng, 16) }
+            { "seed", math::randomString(rng, 16) },
+            { "use", generator.use }
         }}}
     }};
 }
 
+void ChunkPacketCache::release()
+{
+    for(ENetPacket **packet : { &raw, &rle }) {
+        if(*packet && !--(*packet)->referenceCount)
+            enet_packet_destroy(*packet);
+        *packet = nullptr;
+    }
+}
+
 void ServerChunkManager::implOnClear()
 {
+    for(auto &it : chunks)
+        it.second.packets.release();
+
     const auto view = globals::registry.view<ChunkComponent>();
     for(const auto [entity, cp] : view.each())
         globals::registry.destroy(entity);
+    cache.clear();
+    cache_usage = 0;
+    dirty_queue.clear();
+    dirty_count = 0;
 }
 
 bool ServerChunkManager::implOnRemove(const chunkpos_t &cp, ServerChunk &data)
 {
-    if(--data.refcount > 1)
+    // Already in the cache
+    if(data.refcount <= 0)
         return false;
-    globals::registry.destroy(data.entity);
-    return true;
+
+    if(--data.refcount > 0)
+        return false;
+
+    // Don't destroy the chunk right away: a player
+    // walking back and forth across a chunk border
+    // would make us reload it over and over again.
+    // Edits may have made the chunk uniform again.
+    // Nobody is going to be sent it soon either.
+    data.data.optimize();
+    data.packets.release();
+    data.cache_size = sizeof(ServerChunk) + data.data.getMemoryUsage();
+    data.cache_it = cache.insert(cache.begin(), cp);
+    cache_usage += data.cache_size;
+    trimCache();
+    return false;
 }
 
 ServerChunk ServerChunkManager::implOnCreate(const chunkpos_t &cp)
@@ -56,77 +98,490 @@ ServerChunk ServerChunkManager::implOnCreate(const chunkpos_t &cp)
     ServerChunk data;
     data.entity = globals::registry.create();
     globals::registry.emplace<ChunkComponent>(data.entity, ChunkComponent(cp));
+    data.state = ServerChunkState::READY;
     data.data.fill(NULL_VOXEL);
     data.refcount = 1;
+    data.generation = 0;
+    data.dirty = false;
     return std::move(data);
 }
 
 voxel_t ServerChunkManager::implGetVoxel(const ServerChunk &data, const localpos_t &lp) const
 {
-    return data.data[toVoxelIdx(lp)];
+    return data.data.get(toVoxelIdx(lp));
 }
 
 void ServerChunkManager::implSetVoxel(ServerChunk *data, const chunkpos_t &cp, const localpos_t &lp, voxel_t voxel, voxel_set_flags_t flags)
 {
-    // TODO: if the chunk is loaded, broadcast a packet
-    data->data[toVoxelIdx(lp)] = voxel;
+    const voxelidx_t idx = toVoxelIdx(lp);
+    journal.append(cp, idx, voxel, static_cast<uint32_t>(globals::num_ticks));
+
+    // The data would overwrite the edit. The edits hold
+    // a reference so the chunk isn't evicted meanwhile.
+    if(data->state == ServerChunkState::LOADING || data->state == ServerChunkState::GENERATING) {
+        if(data->pending_edits.empty())
+            load(cp);
+        data->pending_edits.emplace_back(idx, voxel);
+        return;
+    }
+
+    if(flags & VOXEL_SET_FORCE)
+        io.unmarkEmpty(cp);
+    applyEdit(*data, cp, idx, voxel);
+
+    // Queued, so the edits of a tick go out as one
+    // packet that is encoded once for all the sessions.
+    network::sendChunk(cp, *data);
 }
 
 void ServerChunkManager::init()
 {
-    stdfs::create_directories(fs::getWritePath("world/chunks"));
-    
     if(!config.read("world/world.toml")) {
         spdlog::warn("world.toml not found, creating a default one.");
         config.write("world/world.toml");
     }
 
-    vgen.init(config);
+    std::string use = config.generator.use;
+    if(!(generator = generators::create(use))) {
+        spdlog::warn("Unknown generator {}, using vgen", use);
+        generator = generators::create(use = "vgen");
+    }
+
+    // Known-empty chunks depend on the generator
+    // and its settings, not just on the seed.
+    generator->init(config);
+    io.init("world/regions", generator->getKey() ^ math::crc64(use));
+
+    pipeline.init(generator.get(), &world_threads, globals::config.world.cache_budget);
+    journal.init("world/journal");
+
+    std::vector<JournalEdit> edits;
+    if(journal.replay(edits))
+        replay(edits);
+    else
+        journal.truncate(journal.rotate());
 }
 
 void ServerChunkManager::shutdown()
 {
-    for(const auto it : chunks) {
-        const voxel_t *data = it.second.data.data();
-        const std::vector<uint8_t> buffer = std::vector<uint8_t>(reinterpret_cast<const uint8_t *>(data), reinterpret_cast<const uint8_t *>(data + CHUNK_VOLUME));
-        fs::writeBytes(fmt::format("world/chunks/c_{}_{}_{}", it.first.x, it.first.y, it.first.z), buffer);
+    // Generator tasks hold a pointer to us
+    world_threads.wait_for_tasks();
+    save();
+
+    // Edits waiting for their chunk to load exist
+    // only in the journal, and so does a failed write.
+    const bool saved = waitCheckpoint() && std::none_of(chunks.cbegin(), chunks.cend(), [](const auto &it) {
+        return !it.second.pending_edits.empty();
+    });
+
+    spdlog::info("Chunk cache: {} hits, {} misses, {} KiB retained", cache_hits, cache_misses, cache_usage >> 10);
+    generator->logStats();
+    pipeline.shutdown();
+
+    io.shutdown();
+
+    // Everything is in the region files now
+    if(saved)
+        journal.truncate(journal.rotate());
+    else
+        spdlog::warn("Some chunks were not saved, keeping the journal");
+    journal.shutdown();
+}
+
+void ServerChunkManager::save()
+{
+    ChronoClock<std::chrono::steady_clock> clock;
+
+    size_t count = 0;
+    std::unordered_map<regionpos_t, std::vector<std::pair<chunkpos_t, ServerChunk *>>> regions;
+    for(auto &it : chunks) {
+        if(it.second.dirty) {
+            regions[toRegionPos(it.first)].emplace_back(it.first, &it.second);
+            count++;
+        }
+    }
+
+    if(!count)
+        return;
+
+    spdlog::info("Saving {} chunks in {} regions", count, regions.size());
+
+    // The main thread is blocked until the very end
+    // so the workers can safely read the chunk data.
+    const size_t base = io.getWriteCount();
+    std::atomic<size_t> submitted { 0 };
+    for(const auto &region : regions) {
+        world_threads.push_task([this, &region, &submitted]() {
+            std::vector<std::pair<chunkpos_t, std::vector<uint8_t>>> batch;
+            batch.reserve(region.second.size());
+            for(const auto &it : region.second) {
+                batch.emplace_back(it.first, std::vector<uint8_t>());
+                chunk_codec::encode(it.second->data, batch.back().second);
+            }
+
+            io.writeBatch(std::move(batch));
+            submitted++;
+        });
+    }
+
+    // The write counter also counts writes queued by
+    // somebody else so it's only good for the progress
+    // report; we are done once a checkpoint queued after
+    // the last batch has been reached.
+    uint64_t id = 0;
+    ChronoClock<std::chrono::steady_clock> progress_clock;
+    for(;;) {
+        if(!id && submitted.load() == regions.size())
+            io.checkpoint(id = ++checkpoint_id);
+        if(id && io.getCheckpoint() >= id)
+            break;
+
+        const size_t written = math::min(io.getWriteCount() - base, count);
+
+        if(progress_clock.elapsed() >= std::chrono::seconds(1)) {
+            spdlog::info("Saving: {}/{} chunks ({}%)", written, count, written * 100 / count);
+            progress_clock.restart();
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+
+    world_threads.wait_for_tasks();
+
+    for(const auto &region : regions) {
+        for(const auto &it : region.second)
+            it.second->dirty = false;
+    }
+
+    dirty_queue.clear();
+    dirty_count = 0;
+    pollFailed();
+
+    spdlog::info("Saved {} out of {} chunks in {:.3f} seconds", count, chunks.size(), util::seconds<float>(clock.elapsed()));
+}
+
+void ServerChunkManager::update()
+{
+    pollResults();
+
+    journal.flush();
+    checkpoint();
+}
+
+bool ServerChunkManager::saveOldest(std::chrono::steady_clock::duration &lag)
+{
+    std::chrono::steady_clock::time_point since;
+    if(!getOldestDirty(since))
+        return false;
+
+    const chunkpos_t cp = dirty_queue.front().first;
+    dirty_queue.pop_front();
+
+    ServerChunk &sc = chunks.at(cp);
+    std::vector<uint8_t> buffer;
+    chunk_codec::encode(sc.data, buffer);
+    io.write(cp, std::move(buffer));
+    sc.dirty = false;
+    dirty_count--;
+
+    lag = std::chrono::steady_clock::now() - since;
+    return true;
+}
+
+bool ServerChunkManager::getOldestDirty(std::chrono::steady_clock::time_point &since)
+{
+    // Entries of chunks that have been saved or
+    // evicted since they were queued are stale.
+    while(!dirty_queue.empty()) {
+        const auto &entry = dirty_queue.front();
+        const auto it = chunks.find(entry.first);
+        if(it != chunks.cend() && it->second.dirty && it->second.dirty_since == entry.second) {
+            since = entry.second;
+            return true;
+        }
+
+        dirty_queue.pop_front();
+    }
+
+    return false;
+}
+
+size_t ServerChunkManager::getDirtyCount() const
+{
+    return dirty_count;
 }
 
 ServerChunk *ServerChunkManager::load(const chunkpos_t &cp)
 {
     const auto it = chunks.find(cp);
     if(it != chunks.cend()) {
-        it->second.refcount++;
+        if(!it->second.refcount++) {
+            cache.erase(it->second.cache_it);
+            cache_usage -= it->second.cache_size;
+            cache_hits++;
+        }
+
         return &it->second;
     }
 
-    voxel_array_t chunk;
-
-    std::vector<uint8_t> buffer;
-    if(fs::readBytes(fmt::format("world/chunks/c_{}_{}_{}", cp.x, cp.y, cp.z), buffer)) {
-        const size_t max_sz = sizeof(voxel_t) * CHUNK_VOLUME;
-        if(buffer.size() > max_sz)
-            buffer.resize(max_sz);
-        std::copy(buffer.cbegin(), buffer.cend(), chunk.begin());
-    }
-    else if(!vgen.generate(cp, chunk)) {
-        //spdlog::debug("null chunk at [{}, {}, {}]", cp.x, cp.y, cp.z);
-        return nullptr;
-    }
+    cache_misses++;
 
     ServerChunk *sc = create(cp);
-    sc->data = chunk;
+    sc->state = ServerChunkState::LOADING;
+    io.read(cp);
     return sc;
 }
 
 void ServerChunkManager::free(const chunkpos_t &cp)
+{
+    // The chunk is written when it's evicted
+    // from the retention cache or on shutdown.
+    remove(cp);
+}
+
+void ServerChunkManager::onLoaded(ChunkIOResult &result)
+{
+    ServerChunk *sc = find(result.position);
+
+    // The chunk was freed before the I/O thread
+    // got to it or it has been loaded already.
+    if(!sc || sc->state != ServerChunkState::LOADING)
+        return;
+
+    if(result.found) {
+        sc->data = std::move(result.data);
+        sc->state = ServerChunkState::READY;
+    }
+    else if(result.empty) {
+        sc->data.fill(NULL_VOXEL);
+        sc->state = ServerChunkState::EMPTY;
+    }
+    else {
+        // Generators are seeded per chunk so the output
+        // doesn't depend on the order chunks finish.
+        sc->state = ServerChunkState::GENERATING;
+        pipeline.request(result.position);
+        return;
+    }
+
+    onReady(result.position, *sc);
+}
+
+void ServerChunkManager::onGenerated(GeneratorResult &result)
+{
+    ServerChunk *sc = find(result.position);
+    if(!sc || sc->state != ServerChunkState::GENERATING)
+        return;
+
+    // Untouched generated chunks can be recreated
+    // by the generator any time unless its output
+    // depends on something besides the seed.
+    const bool deterministic = generator->getFlags() & GENERATOR_DETERMINISTIC;
+
+    if(result.generated) {
+        sc->data = std::move(result.data);
+        sc->state = ServerChunkState::READY;
+        if(config.save_generated || !deterministic)
+            markDirty(*sc, result.position);
+    }
+    else {
+        sc->data.fill(NULL_VOXEL);
+        sc->state = ServerChunkState::EMPTY;
+        if(deterministic)
+            io.markEmpty(result.position);
+    }
+
+    onReady(result.position, *sc);
+}
+
+void ServerChunkManager::onReady(const chunkpos_t &cp, ServerChunk &sc)
+{
+    const bool pinned = !sc.pending_edits.empty();
+    for(const auto &it : sc.pending_edits)
+        applyEdit(sc, cp, it.first, it.second);
+    sc.pending_edits.clear();
+
+    if(sc.state == ServerChunkState::READY)
+        network::sendChunk(cp, sc);
+
+    // Re-account a cached chunk that has just got its
+    // data; this may evict the chunk itself so it goes last.
+    if(!sc.refcount) {
+        cache_usage -= sc.cache_size;
+        sc.cache_size = sizeof(ServerChunk) + sc.data.getMemoryUsage();
+        cache_usage += sc.cache_size;
+        trimCache();
+    }
+    else if(pinned) {
+        // Drop the reference of the edits; this
+        // may put the chunk into the cache too.
+        free(cp);
+    }
+}
+
+bool ServerChunkManager::pollResults()
+{
+    bool polled = false;
+
+    ChunkIOResult result;
+    while(io.poll(result)) {
+        onLoaded(result);
+        polled = true;
+    }
+
+    pollFailed();
+    pipeline.update();
+    trimCache();
+
+    GeneratorResult generated;
+    while(pipeline.poll(generated)) {
+        onGenerated(generated);
+        polled = true;
+    }
+
+    return polled;
+}
+
+void ServerChunkManager::pollFailed()
+{
+    // Save resident chunks again with the latest data.
+    // The I/O thread keeps the data of evicted ones and
+    // tries them again at every checkpoint.
+    chunkpos_t cp;
+    while(io.pollFailed(cp)) {
+        const auto it = chunks.find(cp);
+        if(it != chunks.cend())
+            markDirty(it->second, cp);
+    }
+}
+
+void ServerChunkManager::replay(const std::vector<JournalEdit> &edits)
+{
+    ChronoClock<std::chrono::steady_clock> clock;
+
+    std::unordered_map<chunkpos_t, ServerChunk *> touched;
+    for(const JournalEdit &it : edits) {
+        if(!touched.count(it.chunk))
+            touched[it.chunk] = load(it.chunk);
+    }
+
+    // Nobody is connected yet so we can just wait
+    // for the chunks to be read or generated.
+    for(;;) {
+        const auto loading = std::find_if(touched.cbegin(), touched.cend(), [](const auto &it) {
+            return it.second->state == ServerChunkState::LOADING || it.second->state == ServerChunkState::GENERATING;
+        });
+
+        if(loading == touched.cend())
+            break;
+        if(!pollResults())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for(const JournalEdit &it : edits)
+        applyEdit(*touched[it.chunk], it.chunk, it.idx, it.voxel);
+
+    for(const auto &it : touched)
+        free(it.first);
+
+    // Checkpoint right away: the replayed edits are
+    // in the region files once save() has returned.
+    save();
+    if(waitCheckpoint())
+        journal.truncate(journal.rotate());
+
+    spdlog::info("Replayed {} edits in {} chunks in {:.3f} seconds", edits.size(), touched.size(), util::seconds<float>(clock.elapsed()));
+}
+
+void ServerChunkManager::checkpoint()
+{
+    switch(checkpoint_stage) {
+        case CheckpointStage::IDLE:
+            if(journal.getSegmentSize() >= JOURNAL_SEGMENT_SIZE) {
+                checkpoint_seq = journal.rotate();
+                checkpoint_time = std::chrono::steady_clock::now();
+                checkpoint_stage = CheckpointStage::SAVING;
+            }
+            break;
+
+        case CheckpointStage::SAVING: {
+            // Wait until every chunk that was edited before
+            // the rotation has been handed to the I/O thread.
+            std::chrono::steady_clock::time_point since;
+            if(getOldestDirty(since) && since <= checkpoint_time)
+                break;
+            io.checkpoint(++checkpoint_id);
+            checkpoint_stage = CheckpointStage::FLUSHING;
+            break;
+        }
+
+        case CheckpointStage::FLUSHING:
+            if(io.getCheckpoint() >= checkpoint_id) {
+                if(io.getFailedCheckpoint() >= checkpoint_id)
+                    spdlog::warn("Checkpoint {} failed, keeping the journal", checkpoint_id);
+                else
+                    journal.truncate(checkpoint_seq);
+                checkpoint_stage = CheckpointStage::IDLE;
+            }
+            break;
+    }
+}
+
+bool ServerChunkManager::waitCheckpoint()
+{
+    io.checkpoint(++checkpoint_id);
+    while(io.getCheckpoint() < checkpoint_id)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return io.getFailedCheckpoint() < checkpoint_id;
+}
+
+void ServerChunkManager::applyEdit(ServerChunk &sc, const chunkpos_t &cp, voxelidx_t idx, voxel_t voxel)
+{
+    sc.data.set(idx, voxel);
+    sc.generation++;
+    sc.packets.release();
+    markDirty(sc, cp);
+
+    // The chunk is not empty anymore
+    if(sc.state == ServerChunkState::EMPTY) {
+        sc.state = ServerChunkState::READY;
+        io.unmarkEmpty(cp);
+    }
+}
+
+void ServerChunkManager::markDirty(ServerChunk &sc, const chunkpos_t &cp)
+{
+    if(!sc.dirty) {
+        sc.dirty = true;
+        sc.dirty_since = std::chrono::steady_clock::now();
+        dirty_queue.emplace_back(cp, sc.dirty_since);
+        dirty_count++;
+    }
+}
+
+void ServerChunkManager::evict(const chunkpos_t &cp)
 {
     const auto it = chunks.find(cp);
     if(it != chunks.cend()) {
-        const voxel_t *data = it->second.data.data();
-        const std::vector<uint8_t> buffer = std::vector<uint8_t>(reinterpret_cast<const uint8_t *>(data), reinterpret_cast<const uint8_t *>(data + CHUNK_VOLUME));
-        fs::writeBytes(fmt::format("world/chunks/c_{}_{}_{}", cp.x, cp.y, cp.z), buffer);
-        remove(cp);
+        if(it->second.dirty) {
+            std::vector<uint8_t> buffer;
+            chunk_codec::encode(it->second.data, buffer);
+            io.write(cp, std::move(buffer));
+            dirty_count--;
+        }
+
+        cache.erase(it->second.cache_it);
+        cache_usage -= it->second.cache_size;
+        it->second.packets.release();
+        globals::registry.destroy(it->second.entity);
+        chunks.erase(it);
     }
 }
+
+void ServerChunkManager::trimCache()
+{
+    // Intermediate chunks of the generator pipeline
+    // share the budget with the retained chunks.
+    while(cache_usage + pipeline.getMemoryUsage() > globals::config.world.cache_budget && !cache.empty())
+        evict(cache.back());
+}
@@ -4,15 +4,66 @@
  * All Rights Reserved.
  */
 #pragma once
+#include <chrono>
+#include <deque>
+#include <enet/enet.h>
 #include <entt/entt.hpp>
+#include <list>
 #include <shared/chunks.hpp>
 #include <shared/config.hpp>
-#include <server/vgen.hpp>
+#include <shared/voxel_storage.hpp>
+#include <memory>
+#include <server/chunk_io.hpp>
+#include <server/generator.hpp>
+#include <server/journal.hpp>
+#include <server/pipeline.hpp>
+
+enum class ServerChunkState {
+    LOADING,    // Waiting for the I/O thread
+    GENERATING, // Waiting for the generator
+    READY,      // Has voxel data
+    EMPTY       // Generated empty, never sent
+};
+
+enum class CheckpointStage {
+    IDLE,       // Appending to the current segment
+    SAVING,     // Waiting for the autosave to catch up
+    FLUSHING    // Waiting for the I/O thread
+};
+
+// Encoded ChunkVoxels packets shared by every session
+// the chunk is sent to. The cache holds a reference to
+// each packet of its own; they are valid for the edit
+// generation they were encoded at.
+struct ChunkPacketCache final {
+    uint64_t generation { 0 };
+    ENetPacket *raw { nullptr };
+    ENetPacket *rle { nullptr };
+
+    void release();
+};
 
 struct ServerChunk final {
     entt::entity entity;
-    voxel_array_t data;
+    ServerChunkState state;
+    VoxelStorage data;
     int refcount;
+
+    // Edit generation is bumped on each voxel change
+    // and dirty chunks are the only ones written back.
+    uint64_t generation;
+    mutable ChunkPacketCache packets;
+    bool dirty;
+    std::chrono::steady_clock::time_point dirty_since;
+
+    // Edits made while the chunk is LOADING or
+    // GENERATING are applied once the data is there.
+    std::vector<std::pair<voxelidx_t, voxel_t>> pending_edits;
+
+    // Chunks nobody references are kept in the
+    // retention cache until it runs out of budget.
+    std::list<chunkpos_t>::iterator cache_it;
+    size_t cache_size;
 };
 
 class WorldConfig final : public BaseConfig<WorldConfig> {
@@ -23,8 +74,10 @@ public:
 public:
     int32_t base;
     int32_t height;
+    bool save_generated;
     struct {
         uint64_t seed;
+        std::string use;
     } generator;
 };
 
@@ -38,12 +91,60 @@ public:
 
     void init();
     void shutdown();
+    void update();
+
+    // Writes all the dirty chunks and blocks until
+    // they hit the disk. Chunks are encoded on worker
+    // threads and handed to the I/O thread per region.
+    // Chunks that failed to write stay dirty.
+    void save();
+
+    // Writes the chunk that has been dirty for the
+    // longest time. Returns false if nothing is dirty.
+    bool saveOldest(std::chrono::steady_clock::duration &lag);
+
+    // Returns false if nothing is dirty.
+    bool getOldestDirty(std::chrono::steady_clock::time_point &since);
+    size_t getDirtyCount() const;
+
+    // Returns immediately. If the chunk is not resident
+    // it is returned in the LOADING state, goes through
+    // GENERATING if it's not stored and becomes READY or
+    // EMPTY during one of the next updates. READY chunks
+    // are sent to the sessions that have them loaded.
     ServerChunk *load(const chunkpos_t &cp);
     void free(const chunkpos_t &cp);
 
+private:
+    void onLoaded(ChunkIOResult &result);
+    void onGenerated(GeneratorResult &result);
+    void onReady(const chunkpos_t &cp, ServerChunk &sc);
+    bool pollResults();
+    void pollFailed();
+    void replay(const std::vector<JournalEdit> &edits);
+    void checkpoint();
+    bool waitCheckpoint();
+    void applyEdit(ServerChunk &sc, const chunkpos_t &cp, voxelidx_t idx, voxel_t voxel);
+    void markDirty(ServerChunk &sc, const chunkpos_t &cp);
+    void evict(const chunkpos_t &cp);
+    void trimCache();
+
 public:
     WorldConfig config;
 
 private:
-    VGen vgen;
+    ChunkIO io;
+    EditJournal journal;
+    CheckpointStage checkpoint_stage { CheckpointStage::IDLE };
+    std::chrono::steady_clock::time_point checkpoint_time;
+    uint64_t checkpoint_seq { 0 };
+    uint64_t checkpoint_id { 0 };
+    std::list<chunkpos_t> cache;
+    size_t cache_usage { 0 };
+    size_t cache_hits { 0 };
+    size_t cache_misses { 0 };
+    size_t dirty_count { 0 };
+    std::deque<std::pair<chunkpos_t, std::chrono::steady_clock::time_point>> dirty_queue;
+    std::unique_ptr<Generator> generator;
+    GeneratorPipeline pipeline;
 };
@@ -10,17 +10,31 @@
 void ServerConfig::implPostRead()
 {
     simulation_distance = math::max(toml["simulation_distance"].value_or(4), 1);
+    simulation_height = math::max(toml["simulation_height"].value_or(4), 1);
     net.maxplayers = static_cast<size_t>(toml["net"]["maxplayers"].value_or<unsigned int>(16));
     net.port = toml["net"]["port"].value_or(protocol::DEFAULT_PORT);
+    net.chunk_budget = static_cast<size_t>(math::max(toml["net"]["chunk_budget_kb"].value_or<unsigned int>(64), 1U)) << 10;
+    world.cache_budget = static_cast<size_t>(toml["world"]["cache_budget_mb"].value_or<unsigned int>(64)) << 20;
+    autosave.budget_us = toml["autosave"]["budget_us"].value_or<unsigned int>(2000);
+    autosave.period = math::max(toml["autosave"]["period"].value_or(300.0f), 1.0f);
 }
 
 void ServerConfig::implPreWrite()
 {
     toml = toml::table {{
         { "simulation_distance", simulation_distance },
+        { "simulation_height", simulation_height },
         { "net", toml::table {{
             { "maxplayers", static_cast<unsigned int>(net.maxplayers) },
-            { "port", net.port }
+            { "port", net.port },
+            { "chunk_budget_kb", static_cast<unsigned int>(net.chunk_budget >> 10) }
+        }}},
+        { "world", toml::table {{
+            { "cache_budget_mb", static_cast<unsigned int>(world.cache_budget >> 20) }
+        }}},
+        { "autosave", toml::table {{
+            { "budget_us", static_cast<unsigned int>(autosave.budget_us) },
+            { "period", autosave.period }
         }}}
     }};
 }
@@ -14,8 +14,17 @@ public:
 
 public:
     int32_t simulation_distance;
+    int32_t simulation_height;
     struct {
         size_t maxplayers;
         uint16_t port;
+        size_t chunk_budget;
     } net;
+    struct {
+        size_t cache_budget;
+    } world;
+    struct {
+        uint32_t budget_us;
+        float period;
+    } autosave;
 };
@@ -0,0 +1,123 @@
+/*
+ * dgen.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <algorithm>
+#include <cmath>
+#include <common/math/math.hpp>
+#include <common/math/noise.hpp>
+#include <random>
+#include <server/chunks.hpp>
+#include <server/dgen.hpp>
+
+void DGen::implInit(const WorldConfig &config)
+{
+    base = config.base;
+    cheight = config.height;
+
+    // The lattice step has to divide the chunk size
+    lattice = static_cast<size_t>(config.toml["generator"]["dgen_lattice"].value_or(4));
+    lattice = math::clamp<size_t>(lattice, 1, CHUNK_SIZE);
+    while(CHUNK_SIZE % lattice)
+        lattice--;
+
+    surface = static_cast<float>(base * static_cast<int32_t>(CHUNK_SIZE)) + static_cast<float>(cheight * CHUNK_SIZE) * 0.5f;
+    squash = math::max(config.toml["generator"]["dgen_squash"].value_or(32.0f), 1.0f);
+    smooth = math::max(config.toml["generator"]["dgen_smooth"].value_or(64.0f), 1.0f);
+    cave_smooth = math::max(config.toml["generator"]["dgen_cave_smooth"].value_or(24.0f), 1.0f);
+    cave_width = config.toml["generator"]["dgen_cave_width"].value_or(0.08f);
+    cave_strength = config.toml["generator"]["dgen_cave_strength"].value_or(25.0f);
+
+    addKey(base);
+    addKey(cheight);
+    addKey(lattice);
+    addKey(squash);
+    addKey(smooth);
+    addKey(cave_smooth);
+    addKey(cave_width);
+    addKey(cave_strength);
+
+    std::mt19937_64 rng = std::mt19937_64(seed);
+    std::uniform_real_distribution<double> dist = std::uniform_real_distribution<double>(0.0, 289.0);
+    offset.x = dist(rng);
+    offset.y = dist(rng);
+    offset.z = dist(rng);
+}
+
+bool DGen::implGenerate(const chunkpos_t &cp, VoxelStorage &data) const
+{
+    // Don't generate past these values
+    if(cp.y < base || cp.y > base + cheight)
+        return false;
+
+    std::vector<float> density;
+    sample(cp, density);
+
+    // Interpolation never leaves the range of the
+    // corner samples, so the samples alone tell if
+    // the chunk is completely solid or empty.
+    const auto range = std::minmax_element(density.cbegin(), density.cend());
+    if(*range.second <= 0.0f)
+        return false;
+    if(*range.first > 0.0f) {
+        data.fill(0x01);
+        return true;
+    }
+
+    const size_t n = CHUNK_SIZE / lattice + 1;
+    const float inv = 1.0f / static_cast<float>(lattice);
+
+    voxel_array_t chunk;
+    for(size_t x = 0; x < CHUNK_SIZE; x++) {
+        const size_t lx = x / lattice;
+        const float fx = static_cast<float>(x % lattice) * inv;
+        for(size_t z = 0; z < CHUNK_SIZE; z++) {
+            const size_t lz = z / lattice;
+            const float fz = static_cast<float>(z % lattice) * inv;
+            const float *d00 = &density[((lx + 0) * n + lz + 0) * n];
+            const float *d10 = &density[((lx + 1) * n + lz + 0) * n];
+            const float *d01 = &density[((lx + 0) * n + lz + 1) * n];
+            const float *d11 = &density[((lx + 1) * n + lz + 1) * n];
+            for(size_t y = 0; y < CHUNK_SIZE; y++) {
+                const size_t ly = y / lattice;
+                const float fy = static_cast<float>(y % lattice) * inv;
+                const float c0 = math::lerp(math::lerp(d00[ly], d10[ly], fx), math::lerp(d01[ly], d11[ly], fx), fz);
+                const float c1 = math::lerp(math::lerp(d00[ly + 1], d10[ly + 1], fx), math::lerp(d01[ly + 1], d11[ly + 1], fx), fz);
+                chunk[toVoxelIdx(localpos_t(x, y, z))] = (math::lerp(c0, c1, fy) > 0.0f) ? 0x01 : NULL_VOXEL;
+            }
+        }
+    }
+
+    data.assign(chunk);
+    return !data.isUniform() || data.getUniform() != NULL_VOXEL;
+}
+
+void DGen::sample(const chunkpos_t &cp, std::vector<float> &density) const
+{
+    const size_t n = CHUNK_SIZE / lattice + 1;
+    const voxelpos_t vp = toVoxelPos(cp, localpos_t(0, 0, 0));
+    const double3 origin = double3(vp.x, vp.y, vp.z);
+    const double step = static_cast<double>(lattice);
+
+    std::vector<float> octave(n * n * n), cave(n * n * n);
+    density.assign(n * n * n, 0.0f);
+    for(unsigned int i = 1; i <= 2; i++) {
+        const double scale = static_cast<double>(smooth) / static_cast<double>(i);
+        math::perlinGrid(origin / scale + offset, double3(step / scale), n, n, n, octave.data());
+        for(size_t j = 0; j < octave.size(); j++)
+            density[j] += octave[j] / static_cast<float>(i);
+    }
+
+    math::perlinGrid(origin / static_cast<double>(cave_smooth) - offset, double3(step / cave_smooth), n, n, n, cave.data());
+
+    for(size_t x = 0, j = 0; x < n; x++) {
+        for(size_t z = 0; z < n; z++) {
+            for(size_t y = 0; y < n; y++, j++) {
+                const float wy = static_cast<float>(vp.y) + static_cast<float>(y * lattice);
+                density[j] += (surface - wy) / squash;
+                density[j] -= math::max(cave_width - std::abs(cave[j]), 0.0f) * cave_strength;
+            }
+        }
+    }
+}
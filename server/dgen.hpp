@@ -0,0 +1,35 @@
+/*
+ * dgen.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <server/generator.hpp>
+#include <shared/chunks.hpp>
+#include <shared/voxel_storage.hpp>
+#include <vector>
+
+// Density generator: a voxel is solid where a 3D density
+// field (a falloff around the surface level plus 3D noise
+// minus a cave term) is positive, which gives overhangs
+// and caves. The field is sampled on a coarse lattice
+// every dgen_lattice voxels and interpolated in between.
+// Just like VGen, generate() is called from worker threads.
+class DGen final : public BaseGenerator<DGen> {
+public:
+    constexpr static const generator_flags_t FLAGS = GENERATOR_CONCURRENT | GENERATOR_DETERMINISTIC;
+
+    void implInit(const WorldConfig &config);
+    bool implGenerate(const chunkpos_t &cp, VoxelStorage &data) const;
+
+private:
+    // Lattice samples stored in x-z-y order
+    void sample(const chunkpos_t &cp, std::vector<float> &density) const;
+
+private:
+    int32_t base, cheight;
+    size_t lattice;
+    float surface, squash, smooth;
+    float cave_smooth, cave_width, cave_strength;
+    double3 offset;
+};
@@ -0,0 +1,129 @@
+/*
+ * empty_index.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <server/empty_index.hpp>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+constexpr static const size_t MAX_CACHED_REGIONS = 64;
+constexpr static const size_t BITS_SIZE = REGION_VOLUME / 8;
+
+struct EmptyIndexHeader final {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t key;
+};
+
+void EmptyIndex::init(const stdfs::path &dir, uint64_t key)
+{
+    this->dir = fs::getWritePath(dir);
+    this->key = key;
+    stdfs::create_directories(this->dir);
+}
+
+void EmptyIndex::shutdown()
+{
+    flush();
+    regions.clear();
+}
+
+void EmptyIndex::flush()
+{
+    for(auto &it : regions)
+        store(it.first, it.second);
+}
+
+bool EmptyIndex::get(const chunkpos_t &cp)
+{
+    return find(toRegionPos(cp)).bits.test(toRegionIdx(cp));
+}
+
+void EmptyIndex::set(const chunkpos_t &cp, bool empty)
+{
+    Region &region = find(toRegionPos(cp));
+    const regionidx_t idx = toRegionIdx(cp);
+    if(region.bits.test(idx) != empty) {
+        region.bits.set(idx, empty);
+        region.dirty = true;
+    }
+}
+
+EmptyIndex::Region &EmptyIndex::find(const regionpos_t &rp)
+{
+    const auto it = regions.find(rp);
+    if(it != regions.end()) {
+        it->second.use = ++use_counter;
+        return it->second;
+    }
+
+    if(regions.size() >= MAX_CACHED_REGIONS) {
+        auto lru = regions.begin();
+        for(auto jt = regions.begin(); jt != regions.end(); jt++) {
+            if(jt->second.use < lru->second.use)
+                lru = jt;
+        }
+
+        store(lru->first, lru->second);
+        regions.erase(lru);
+    }
+
+    Region &region = regions[rp];
+    region.use = ++use_counter;
+    region.dirty = false;
+    region.bits.reset();
+
+    std::ifstream ifs(dir / fmt::format("e_{}_{}_{}", rp.x, rp.y, rp.z), std::ios::binary);
+    if(ifs.is_open()) {
+        EmptyIndexHeader header = {};
+        uint8_t bytes[BITS_SIZE] = {};
+        ifs.read(reinterpret_cast<char *>(&header), sizeof(header));
+        ifs.read(reinterpret_cast<char *>(bytes), sizeof(bytes));
+
+        // A different generator might produce
+        // something for these chunks now.
+        if(ifs && header.magic == EMPTY_INDEX_MAGIC && header.version == EMPTY_INDEX_VERSION && header.key == key) {
+            for(size_t i = 0; i < REGION_VOLUME; i++)
+                region.bits.set(i, (bytes[i >> 3] >> (i & 7)) & 1);
+        }
+    }
+
+    return region;
+}
+
+void EmptyIndex::store(const regionpos_t &rp, Region &region)
+{
+    if(!region.dirty)
+        return;
+
+    const stdfs::path path = dir / fmt::format("e_{}_{}_{}", rp.x, rp.y, rp.z);
+    if(region.bits.none()) {
+        stdfs::remove(path);
+        region.dirty = false;
+        return;
+    }
+
+    EmptyIndexHeader header = {};
+    header.magic = EMPTY_INDEX_MAGIC;
+    header.version = EMPTY_INDEX_VERSION;
+    header.flags = 0;
+    header.key = key;
+
+    uint8_t bytes[BITS_SIZE] = {};
+    for(size_t i = 0; i < REGION_VOLUME; i++) {
+        if(region.bits.test(i))
+            bytes[i >> 3] |= static_cast<uint8_t>(1 << (i & 7));
+    }
+
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if(!ofs.is_open()) {
+        spdlog::warn("Unable to write {}", path.string());
+        return;
+    }
+
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(bytes), sizeof(bytes));
+    region.dirty = false;
+}
@@ -0,0 +1,46 @@
+/*
+ * empty_index.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <bitset>
+#include <server/region.hpp>
+
+constexpr static const uint32_t EMPTY_INDEX_MAGIC = 0x49455856; // 'VXEI'
+constexpr static const uint16_t EMPTY_INDEX_VERSION = 2;
+
+// Remembers chunks the generator produced nothing for
+// so they are not generated again each time a player
+// comes close. Stored as one bit per chunk in small
+// e_{rx}_{ry}_{rz} files next to the region files since
+// sky regions usually don't have a region file at all.
+// The index is bound to a generator key: a world with
+// a different seed, generator or generator settings
+// ignores the old bits.
+class EmptyIndex final : public NonCopyable {
+public:
+    void init(const stdfs::path &dir, uint64_t key);
+    void shutdown();
+    void flush();
+
+    bool get(const chunkpos_t &cp);
+    void set(const chunkpos_t &cp, bool empty);
+
+private:
+    struct Region final {
+        uint64_t use;
+        bool dirty;
+        std::bitset<REGION_VOLUME> bits;
+    };
+
+private:
+    Region &find(const regionpos_t &rp);
+    void store(const regionpos_t &rp, Region &region);
+
+private:
+    stdfs::path dir;
+    uint64_t key { 0 };
+    uint64_t use_counter { 0 };
+    std::unordered_map<regionpos_t, Region> regions;
+};
@@ -0,0 +1,47 @@
+/*
+ * flatgen.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <common/math/math.hpp>
+#include <server/chunks.hpp>
+#include <server/flatgen.hpp>
+
+void FlatGen::implInit(const WorldConfig &config)
+{
+    base = config.base;
+    cheight = config.height;
+    height = math::clamp<int64_t>(config.toml["generator"]["flat_height"].value_or(16), 0, static_cast<int64_t>(cheight) * CHUNK_SIZE);
+
+    addKey(base);
+    addKey(cheight);
+    addKey(height);
+}
+
+bool FlatGen::implGenerate(const chunkpos_t &cp, VoxelStorage &data) const
+{
+    if(cp.y < base || cp.y > base + cheight)
+        return false;
+
+    const int64_t bottom = static_cast<int64_t>(cp.y - base) * CHUNK_SIZE;
+    if(bottom >= height)
+        return false;
+
+    if(bottom + static_cast<int64_t>(CHUNK_SIZE) <= height) {
+        data.fill(0x01);
+        return true;
+    }
+
+    voxel_array_t chunk;
+    chunk.fill(NULL_VOXEL);
+    for(int16_t x = 0; x < CHUNK_SIZE; x++) {
+        for(int16_t z = 0; z < CHUNK_SIZE; z++) {
+            for(int64_t y = 0; y < height - bottom; y++) {
+                chunk[toVoxelIdx(localpos_t(x, y, z))] = 0x01;
+            }
+        }
+    }
+
+    data.assign(chunk);
+    return true;
+}
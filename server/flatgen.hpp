@@ -0,0 +1,22 @@
+/*
+ * flatgen.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <server/generator.hpp>
+
+// Flat world: everything below flat_height voxels
+// (counted from the world base) is solid. Useful for
+// testing since almost every chunk comes out uniform.
+class FlatGen final : public BaseGenerator<FlatGen> {
+public:
+    constexpr static const generator_flags_t FLAGS = GENERATOR_CONCURRENT | GENERATOR_DETERMINISTIC;
+
+    void implInit(const WorldConfig &config);
+    bool implGenerate(const chunkpos_t &cp, VoxelStorage &data) const;
+
+private:
+    int32_t base, cheight;
+    int64_t height;
+};
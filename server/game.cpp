@@ -6,6 +6,7 @@
 #include <common/math/const.hpp>
 #include <common/math/math.hpp>
 #include <ctime>
+#include <server/autosave.hpp>
 #include <server/chunks.hpp>
 #include <server/game.hpp>
 #include <server/globals.hpp>
@@ -74,11 +75,13 @@ void sv_game::postInit()
 
 void sv_game::shutdown()
 {
+    autosave::logStats();
     globals::chunks.shutdown();
     globals::registry.clear();
 }
 
 void sv_game::update()
 {
-
+    globals::chunks.update();
+    autosave::update();
 }
@@ -0,0 +1,89 @@
+/*
+ * generator.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <common/math/crc64.hpp>
+#include <cstring>
+#include <server/chunks.hpp>
+#include <server/dgen.hpp>
+#include <server/flatgen.hpp>
+#include <server/generator.hpp>
+#include <server/vgen.hpp>
+
+template<typename T>
+static std::unique_ptr<Generator> makeGenerator()
+{
+    return std::make_unique<T>();
+}
+
+struct GeneratorEntry final {
+    const char *name;
+    std::unique_ptr<Generator>(*factory)();
+};
+
+static const GeneratorEntry registry[] = {
+    { "flat", &makeGenerator<FlatGen> },
+    { "vgen", &makeGenerator<VGen> },
+    { "dgen", &makeGenerator<DGen> }
+};
+
+void Generator::surface(const chunkpos_t &, const GeneratorNeighbourhood &, VoxelStorage &) const
+{
+
+}
+
+void Generator::decorate(const chunkpos_t &, const GeneratorNeighbourhood &, VoxelStorage &) const
+{
+
+}
+
+void Generator::logStats() const
+{
+
+}
+
+void Generator::initSeed(const WorldConfig &config)
+{
+    key = seed = config.generator.seed;
+}
+
+void Generator::addKey(const void *data, size_t size)
+{
+    // Chained so the order of the settings matters
+    uint8_t buffer[2 * sizeof(uint64_t)];
+    const uint64_t value = math::crc64(data, size);
+    std::memcpy(buffer, &key, sizeof(uint64_t));
+    std::memcpy(buffer + sizeof(uint64_t), &value, sizeof(uint64_t));
+    key = math::crc64(buffer, sizeof(buffer));
+}
+
+uint64_t Generator::getKey() const
+{
+    return key;
+}
+
+uint64_t Generator::getChunkSeed(const chunkpos_t &cp) const
+{
+    // SplitMix64 finalizer over the world seed
+    // and each of the chunk coordinates.
+    uint64_t x = seed;
+    for(const int32_t c : { cp.x, cp.y, cp.z }) {
+        x += 0x9E3779B97F4A7C15 + static_cast<uint64_t>(static_cast<uint32_t>(c));
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+        x = x ^ (x >> 31);
+    }
+
+    return x;
+}
+
+std::unique_ptr<Generator> sv_generators::create(const std::string &name)
+{
+    for(const GeneratorEntry &entry : registry) {
+        if(name == entry.name)
+            return entry.factory();
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,147 @@
+/*
+ * generator.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <array>
+#include <memory>
+#include <shared/chunks.hpp>
+#include <shared/voxel_storage.hpp>
+#include <string>
+
+class WorldConfig;
+
+// Contract flags every generator declares. The chunk
+// manager relies on them to decide how to schedule
+// generation and what it can avoid storing.
+using generator_flags_t = uint16_t;
+
+// generate() may run on several workers at once.
+// Without it the calls are serialized.
+constexpr static const generator_flags_t GENERATOR_CONCURRENT = (1 << 0);
+
+// The output depends only on the world seed and the
+// chunk position: randomness comes from getChunkSeed().
+// Without it generated chunks are always saved and
+// never recorded in the known-empty index.
+constexpr static const generator_flags_t GENERATOR_DETERMINISTIC = (1 << 1);
+
+// generate() is followed by surface() and decorate()
+// which see the neighbouring chunks. Without it the
+// chunk is done as soon as generate() returns.
+constexpr static const generator_flags_t GENERATOR_STAGED = (1 << 2);
+
+// A chunk advances to a stage only when itself and
+// all its 26 neighbours have reached the previous one.
+enum class GeneratorStage {
+    NONE,
+    TERRAIN,    // generate(): the chunk alone
+    SURFACE,    // surface(): sees terrain around
+    FEATURES    // decorate(): sees surface around
+};
+
+// Read-only view of a chunk and its neighbours as they
+// were after the previous stage. Stages never write to
+// it so it can be shared by the tasks of neighbours.
+struct GeneratorNeighbourhood final {
+    // Indexed in x-z-y order like voxels
+    std::array<std::shared_ptr<const VoxelStorage>, 27> chunks;
+
+    // Coordinates are relative to the origin of the center
+    // chunk and must lie within one chunk away from it.
+    inline voxel_t get(int32_t x, int32_t y, int32_t z) const
+    {
+        constexpr const int32_t size = static_cast<int32_t>(CHUNK_SIZE);
+        const int32_t cx = (x + size) / size;
+        const int32_t cy = (y + size) / size;
+        const int32_t cz = (z + size) / size;
+        const localpos_t lp = localpos_t(x - (cx - 1) * size, y - (cy - 1) * size, z - (cz - 1) * size);
+        return chunks[(cx * 3 + cz) * 3 + cy]->get(toVoxelIdx(lp));
+    }
+};
+
+class Generator {
+public:
+    virtual ~Generator() = default;
+    virtual void init(const WorldConfig &config) = 0;
+
+    // Returns false if the chunk is empty
+    virtual bool generate(const chunkpos_t &cp, VoxelStorage &data) const = 0;
+
+    // Called for GENERATOR_STAGED generators only. The
+    // data starts as a copy of the center chunk and only
+    // the center chunk can be changed. A feature that
+    // crosses a border is placed by every chunk it covers.
+    virtual void surface(const chunkpos_t &cp, const GeneratorNeighbourhood &around, VoxelStorage &data) const;
+    virtual void decorate(const chunkpos_t &cp, const GeneratorNeighbourhood &around, VoxelStorage &data) const;
+
+    virtual generator_flags_t getFlags() const = 0;
+    virtual void logStats() const;
+
+    uint64_t getChunkSeed(const chunkpos_t &cp) const;
+
+    // Identifies the output: the seed and every setting
+    // the generated voxels depend on. Known-empty chunks
+    // recorded under a different key are generated again.
+    uint64_t getKey() const;
+
+protected:
+    void initSeed(const WorldConfig &config);
+
+    // Called from implInit() for every setting
+    // (and tuning constant) the output depends on.
+    void addKey(const void *data, size_t size);
+    template<typename V>
+    void addKey(const V &value);
+
+protected:
+    uint64_t seed { 0 };
+    uint64_t key { 0 };
+};
+
+template<typename V>
+inline void Generator::addKey(const V &value)
+{
+    addKey(&value, sizeof(V));
+}
+
+// Implementations are compiled against this template so
+// the only virtual call is the one per chunk. They define:
+//  constexpr static const generator_flags_t FLAGS
+//  void implInit(const WorldConfig &config)
+//  bool implGenerate(const chunkpos_t &cp, VoxelStorage &data) const
+template<typename T>
+class BaseGenerator : public Generator {
+public:
+    void init(const WorldConfig &config) override final;
+    bool generate(const chunkpos_t &cp, VoxelStorage &data) const override final;
+    generator_flags_t getFlags() const override final;
+};
+
+template<typename T>
+inline void BaseGenerator<T>::init(const WorldConfig &config)
+{
+    initSeed(config);
+    static_cast<T *>(this)->implInit(config);
+}
+
+template<typename T>
+inline bool BaseGenerator<T>::generate(const chunkpos_t &cp, VoxelStorage &data) const
+{
+    return static_cast<const T *>(this)->implGenerate(cp, data);
+}
+
+template<typename T>
+inline generator_flags_t BaseGenerator<T>::getFlags() const
+{
+    return T::FLAGS;
+}
+
+namespace sv_generators
+{
+// Returns nullptr for unknown names
+std::unique_ptr<Generator> create(const std::string &name);
+} // namespace sv_generators
+
+namespace generators = sv_generators;
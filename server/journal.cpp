@@ -0,0 +1,270 @@
+/*
+ * journal.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <algorithm>
+#include <common/math/crc64.hpp>
+#include <cstdio>
+#include <iterator>
+#include <server/journal.hpp>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+// Segment layout (little endian):
+//  uint32_t magic
+//  uint16_t version
+//  uint16_t reserved
+//  records[]
+//
+// Record layout:
+//  int32_t  chunk x, y, z
+//  uint16_t voxel index
+//  uint8_t  voxel
+//  uint8_t  reserved
+//  uint32_t tick
+//  uint32_t CRC64 of the above, truncated
+constexpr static const size_t SEGMENT_HEADER_SIZE = 8;
+constexpr static const size_t RECORD_SIZE = 24;
+constexpr static const size_t RECORD_CHECK_OFFSET = 20;
+
+template<typename T>
+static inline void putValue(uint8_t *p, T value)
+{
+    for(size_t i = 0; i < sizeof(T); i++)
+        p[i] = static_cast<uint8_t>(value >> (i * 8));
+}
+
+template<typename T>
+static inline const T getValue(const uint8_t *p)
+{
+    T value = 0;
+    for(size_t i = 0; i < sizeof(T); i++)
+        value |= static_cast<T>(p[i]) << (i * 8);
+    return value;
+}
+
+static const std::vector<uint64_t> listSegments(const stdfs::path &dir)
+{
+    std::vector<uint64_t> segments;
+    for(const stdfs::directory_entry &it : stdfs::directory_iterator(dir)) {
+        unsigned long long seq;
+        const std::string filename = it.path().filename().string();
+        if(it.is_regular_file() && std::sscanf(filename.c_str(), "j_%llu", &seq) == 1)
+            segments.push_back(static_cast<uint64_t>(seq));
+    }
+
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+void EditJournal::init(const stdfs::path &dir)
+{
+    this->dir = fs::getWritePath(dir);
+    stdfs::create_directories(this->dir);
+
+    // Old segments are kept until the first checkpoint,
+    // new edits always go into a brand new segment.
+    const std::vector<uint64_t> segments = listSegments(this->dir);
+    seq = segments.empty() ? 0 : segments.back() + 1;
+    segment_size = SEGMENT_HEADER_SIZE;
+
+    running = true;
+    thread = std::thread(&EditJournal::threadFunc, this);
+    submit(JournalTask { JournalTaskType::ROTATE, seq, {} });
+}
+
+void EditJournal::shutdown()
+{
+    flush();
+
+    {
+        std::scoped_lock lock(mutex);
+        running = false;
+    }
+
+    cv.notify_all();
+    if(thread.joinable())
+        thread.join();
+    tasks.clear();
+}
+
+size_t EditJournal::replay(std::vector<JournalEdit> &edits)
+{
+    size_t count = 0;
+    for(const uint64_t it : listSegments(dir)) {
+        if(it >= seq)
+            break;
+
+        const std::string filename = fmt::format("j_{}", it);
+        std::ifstream ifs(dir / filename, std::ios::binary);
+        const std::vector<uint8_t> data = std::vector<uint8_t>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        if(data.size() < SEGMENT_HEADER_SIZE || getValue<uint32_t>(data.data()) != JOURNAL_MAGIC) {
+            spdlog::warn("Journal segment {} is unreadable", filename);
+            continue;
+        }
+
+        for(size_t offset = SEGMENT_HEADER_SIZE; offset + RECORD_SIZE <= data.size(); offset += RECORD_SIZE) {
+            const uint8_t *record = data.data() + offset;
+            if(getValue<uint32_t>(record + RECORD_CHECK_OFFSET) != static_cast<uint32_t>(math::crc64(record, RECORD_CHECK_OFFSET))) {
+                spdlog::warn("Journal segment {} is corrupted at {}", filename, offset);
+                break;
+            }
+
+            JournalEdit edit;
+            edit.chunk.x = static_cast<int32_t>(getValue<uint32_t>(record + 0));
+            edit.chunk.y = static_cast<int32_t>(getValue<uint32_t>(record + 4));
+            edit.chunk.z = static_cast<int32_t>(getValue<uint32_t>(record + 8));
+            edit.idx = static_cast<voxelidx_t>(getValue<uint16_t>(record + 12));
+            edit.voxel = static_cast<voxel_t>(getValue<uint8_t>(record + 14));
+            edit.tick = getValue<uint32_t>(record + 16);
+            if(edit.idx >= CHUNK_VOLUME)
+                continue;
+
+            edits.push_back(edit);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void EditJournal::append(const chunkpos_t &cp, voxelidx_t idx, voxel_t voxel, uint32_t tick)
+{
+    const size_t offset = buffer.size();
+    buffer.resize(offset + RECORD_SIZE);
+
+    uint8_t *record = buffer.data() + offset;
+    putValue<uint32_t>(record + 0, static_cast<uint32_t>(cp.x));
+    putValue<uint32_t>(record + 4, static_cast<uint32_t>(cp.y));
+    putValue<uint32_t>(record + 8, static_cast<uint32_t>(cp.z));
+    putValue<uint16_t>(record + 12, static_cast<uint16_t>(idx));
+    putValue<uint8_t>(record + 14, static_cast<uint8_t>(voxel));
+    putValue<uint8_t>(record + 15, 0);
+    putValue<uint32_t>(record + 16, tick);
+    putValue<uint32_t>(record + RECORD_CHECK_OFFSET, static_cast<uint32_t>(math::crc64(record, RECORD_CHECK_OFFSET)));
+}
+
+void EditJournal::flush()
+{
+    if(buffer.empty())
+        return;
+    segment_size += buffer.size();
+    submit(JournalTask { JournalTaskType::WRITE, seq, std::move(buffer) });
+    buffer.clear();
+}
+
+uint64_t EditJournal::rotate()
+{
+    flush();
+    segment_size = SEGMENT_HEADER_SIZE;
+    submit(JournalTask { JournalTaskType::ROTATE, ++seq, {} });
+    return seq;
+}
+
+void EditJournal::truncate(uint64_t seq)
+{
+    submit(JournalTask { JournalTaskType::TRUNCATE, seq, {} });
+}
+
+size_t EditJournal::getSegmentSize() const
+{
+    return segment_size + buffer.size();
+}
+
+void EditJournal::submit(JournalTask &&task)
+{
+    {
+        std::scoped_lock lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+
+    cv.notify_one();
+}
+
+void EditJournal::threadFunc()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;) {
+        // Wake up now and then to sync the segment
+        cv.wait_for(lock, JOURNAL_SYNC_INTERVAL, [this]() { return !tasks.empty() || !running; });
+
+        // Drain the queue before exiting so the
+        // records submitted on shutdown hit the disk.
+        if(tasks.empty() && !running)
+            break;
+
+        std::deque<JournalTask> batch;
+        batch.swap(tasks);
+        lock.unlock();
+
+        for(const JournalTask &task : batch) {
+            switch(task.type) {
+                case JournalTaskType::WRITE:
+                    write(task.buffer);
+                    break;
+                case JournalTaskType::ROTATE:
+                    sync();
+                    file.close();
+                    openSegment(task.seq);
+                    break;
+                case JournalTaskType::TRUNCATE:
+                    removeSegments(task.seq);
+                    break;
+            }
+        }
+
+        if(unsynced && std::chrono::steady_clock::now() - sync_time >= JOURNAL_SYNC_INTERVAL)
+            sync();
+
+        lock.lock();
+    }
+
+    sync();
+    file.close();
+}
+
+void EditJournal::write(const std::vector<uint8_t> &records)
+{
+    if(!file.is_open())
+        return;
+    file.write(reinterpret_cast<const char *>(records.data()), static_cast<std::streamsize>(records.size()));
+    file.flush();
+    unsynced = true;
+}
+
+void EditJournal::sync()
+{
+    sync_time = std::chrono::steady_clock::now();
+    if(unsynced && !fs::syncFile(dir / fmt::format("j_{}", file_seq)))
+        spdlog::warn("Unable to sync journal segment j_{}", file_seq);
+    unsynced = false;
+}
+
+bool EditJournal::openSegment(uint64_t new_seq)
+{
+    file_seq = new_seq;
+    file.open(dir / fmt::format("j_{}", file_seq), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) {
+        spdlog::error("Unable to open journal segment j_{}", file_seq);
+        return false;
+    }
+
+    uint8_t header[SEGMENT_HEADER_SIZE] = {};
+    putValue<uint32_t>(header + 0, JOURNAL_MAGIC);
+    putValue<uint16_t>(header + 4, JOURNAL_VERSION);
+    putValue<uint16_t>(header + 6, 0);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.flush();
+    unsynced = true;
+    return true;
+}
+
+void EditJournal::removeSegments(uint64_t before)
+{
+    for(const uint64_t it : listSegments(dir)) {
+        if(it >= before)
+            break;
+        stdfs::remove(dir / fmt::format("j_{}", it));
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * journal.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <common/filesystem.hpp>
+#include <chrono>
+#include <common/traits.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared/world.hpp>
+#include <thread>
+#include <vector>
+
+constexpr static const uint32_t JOURNAL_MAGIC = 0x4E4A5856; // 'VXJN'
+constexpr static const uint16_t JOURNAL_VERSION = 1;
+constexpr static const size_t JOURNAL_SEGMENT_SIZE = 1 << 20;
+constexpr static const std::chrono::seconds JOURNAL_SYNC_INTERVAL = std::chrono::seconds(1);
+
+struct JournalEdit final {
+    chunkpos_t chunk;
+    voxelidx_t idx;
+    voxel_t voxel;
+    uint32_t tick;
+};
+
+enum class JournalTaskType {
+    WRITE,
+    ROTATE,
+    TRUNCATE
+};
+
+struct JournalTask final {
+    JournalTaskType type;
+    uint64_t seq;
+    std::vector<uint8_t> buffer;
+};
+
+// Write-ahead log of voxel edits. Each edit is a small
+// fixed-size record appended to the current segment file
+// (j_{seq}); segments are dropped once every chunk they
+// touch has been written to the region files. The files
+// are written, synced, switched and removed by a thread
+// of the journal's own in the order the calls were made.
+class EditJournal final : public NonCopyable {
+public:
+    void init(const stdfs::path &dir);
+    void shutdown();
+
+    // Reads the edits of all the segments left from the
+    // previous run in order. Stops at the first torn or
+    // corrupted record of a segment.
+    size_t replay(std::vector<JournalEdit> &edits);
+
+    void append(const chunkpos_t &cp, voxelidx_t idx, voxel_t voxel, uint32_t tick);
+
+    // Hands the buffered records to the journal thread.
+    // Called once per tick so an edit costs nothing but
+    // a memcpy. The thread syncs the current segment at
+    // most JOURNAL_SYNC_INTERVAL after a write.
+    void flush();
+
+    // Starts a new segment and returns its number; the
+    // previous one is synced first. Everything before
+    // the new segment can be dropped later.
+    uint64_t rotate();
+    void truncate(uint64_t seq);
+
+    size_t getSegmentSize() const;
+
+private:
+    void submit(JournalTask &&task);
+    void threadFunc();
+
+    // Journal thread only
+    void write(const std::vector<uint8_t> &records);
+    void sync();
+    bool openSegment(uint64_t new_seq);
+    void removeSegments(uint64_t before);
+
+private:
+    stdfs::path dir;
+    uint64_t seq { 0 };
+    size_t segment_size { 0 };
+    std::vector<uint8_t> buffer;
+
+    bool running { false };
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<JournalTask> tasks;
+
+    uint64_t file_seq { 0 };
+    bool unsynced { false };
+    std::chrono::steady_clock::time_point sync_time;
+    std::ofstream file;
+};
@@ -3,6 +3,10 @@
  * Copyright (c) 2021, Kirill GPRB.
  * All Rights Reserved.
  */
+#include <algorithm>
+#include <cmath>
+#include <common/math/math.hpp>
+#include <common/util/clock.hpp>
 #include <common/util/format.hpp>
 #include <enet/enet.h>
 #include <exception>
@@ -16,6 +20,7 @@
 #include <shared/protocol/packets/client/handshake.hpp>
 #include <shared/protocol/packets/client/login_start.hpp>
 #include <shared/protocol/packets/server/chunk_voxels.hpp>
+#include <shared/protocol/packets/server/chunk_voxels_rle.hpp>
 #include <shared/protocol/packets/server/login_success.hpp>
 #include <shared/protocol/packets/server/player_info_entry.hpp>
 #include <shared/protocol/packets/server/player_info_username.hpp>
@@ -33,46 +38,281 @@
 #include <shared/protocol/protocol.hpp>
 #include <server/config.hpp>
 #include <shared/util/enet.hpp>
+#include <shared/voxel_rle.hpp>
 #include <spdlog/spdlog.h>
 #include <unordered_map>
 #include <vector>
 
+// Chunk data goes through its own channel so
+// it doesn't hold back the rest of the packets.
+constexpr static const uint8_t CHUNK_CHANNEL = 1;
+
+// Queued chunks are sorted in groups of this
+// size until the per-tick budget runs out.
+constexpr static const size_t CHUNK_SEND_BATCH = 32;
+
+// Login work done per joining session per tick
+constexpr static const size_t LOGIN_VOXEL_DEFS = 16;
+constexpr static const size_t LOGIN_CHUNKS = 512;
+constexpr static const size_t LOGIN_PLAYERS = 8;
+
 static uint32_t session_id_base = 0;
 static std::unordered_map<uint32_t, ServerSession> sessions;
 
-static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &, ServerSession *)> packet_handlers = {
-    {
-        protocol::packets::Handshake::id,
-        [](const std::vector<uint8_t> &payload, ServerSession *session) {
-            protocol::packets::Handshake packet;
-            protocol::deserialize(payload, packet);
+struct ChunkSendStats final {
+    size_t count { 0 };
+    size_t encoded { 0 };
+    size_t raw_bytes { 0 };
+    size_t wire_bytes { 0 };
+    std::chrono::steady_clock::duration encode_time { 0 };
+};
 
-            if(packet.protocol_version != protocol::VERSION) {
-                network::kick(session, util::format("Protocol versions differ (server: %hu, client: %hu)", protocol::VERSION, packet.protocol_version));
-                return;
+static ChunkSendStats chunk_stats;
+
+static ENetPacket *createPacket(const std::vector<uint8_t> &pbuf)
+{
+    // The cache keeps a reference so the packet
+    // survives being sent to the first peer.
+    ENetPacket *packet = enet_packet_create(pbuf.data(), pbuf.size(), ENET_PACKET_FLAG_RELIABLE);
+    packet->referenceCount++;
+    return packet;
+}
+
+// Chunks are encoded once per edit generation and
+// the same packet is sent to every session.
+static ENetPacket *getChunkPacket(const chunkpos_t &cp, const ServerChunk &sc, bool rle)
+{
+    ChunkPacketCache &packets = sc.packets;
+    if(packets.generation != sc.generation) {
+        packets.release();
+        packets.generation = sc.generation;
+    }
+
+    if(rle && packets.rle)
+        return packets.rle;
+    if(!rle && packets.raw)
+        return packets.raw;
+
+    ChronoClock<std::chrono::steady_clock> clock;
+
+    protocol::packets::ChunkVoxels chunkp = {};
+    math::vecToArray(cp, chunkp.position);
+    sc.data.unpack(chunkp.data);
+
+    if(rle) {
+        protocol::packets::ChunkVoxelsRLE rlep = {};
+        std::copy(chunkp.position, chunkp.position + 3, rlep.position);
+        voxel_rle::encode(chunkp.data, rlep.data);
+
+        // Noise doesn't compress
+        if(rlep.data.size() < sizeof(voxel_t) * CHUNK_VOLUME)
+            packets.rle = createPacket(protocol::serialize(rlep));
+    }
+
+    if(!packets.rle || !rle) {
+        if(!packets.raw)
+            packets.raw = createPacket(protocol::serialize(chunkp));
+
+        // Share the raw packet with RLE sessions too
+        if(rle) {
+            packets.rle = packets.raw;
+            packets.rle->referenceCount++;
+        }
+    }
+
+    chunk_stats.encoded++;
+    chunk_stats.encode_time += clock.elapsed();
+    return rle ? packets.rle : packets.raw;
+}
+
+static size_t sendChunkVoxels(ServerSession *session, const chunkpos_t &cp, const ServerChunk &sc)
+{
+    ENetPacket *packet = getChunkPacket(cp, sc, session->features & protocol::FEATURE_CHUNK_RLE);
+    enet_peer_send(session->peer, CHUNK_CHANNEL, packet);
+
+    chunk_stats.count++;
+    chunk_stats.raw_bytes += sizeof(voxel_t) * CHUNK_VOLUME;
+    chunk_stats.wire_bytes += packet->dataLength;
+    return packet->dataLength;
+}
+
+static void queueChunk(ServerSession *session, const chunkpos_t &cp, const ServerChunk &sc)
+{
+    if(sc.state == ServerChunkState::READY)
+        session->send_queue.insert(cp);
+}
+
+// Sends up to net.chunk_budget bytes of queued chunks.
+// Lower priority goes first: the squared distance to
+// the player, up to twice as much for chunks behind.
+static void sendQueuedChunks(ServerSession *session)
+{
+    if(session->send_queue.empty() || !globals::registry.valid(session->player_entity))
+        return;
+
+    const CreatureComponent *creature = globals::registry.try_get<CreatureComponent>(session->player_entity);
+    const HeadComponent *head = globals::registry.try_get<HeadComponent>(session->player_entity);
+    const chunkpos_t origin = creature ? toChunkPos(creature->position) : chunkpos_t(0, 0, 0);
+    const float3 forward = head ? floatquat(float3(head->angles.x, head->angles.y, 0.0f)) * FLOAT3_FORWARD : FLOAT3_ZERO;
+
+    std::vector<std::pair<float, chunkpos_t>> queue;
+    queue.reserve(session->send_queue.size());
+    for(const chunkpos_t &cp : session->send_queue) {
+        const float3 delta = float3(cp - origin);
+        const float distance = glm::dot(delta, delta);
+        const float facing = (distance > 0.0f) ? glm::dot(delta, forward) / std::sqrt(distance) : 1.0f;
+        queue.emplace_back(distance * (1.5f - 0.5f * facing), cp);
+    }
+
+    const auto compare = [](const std::pair<float, chunkpos_t> &a, const std::pair<float, chunkpos_t> &b) {
+        return a.first < b.first;
+    };
+
+    size_t budget = globals::config.net.chunk_budget;
+    for(auto it = queue.begin(); it != queue.end() && budget;) {
+        const auto middle = it + std::min<ptrdiff_t>(CHUNK_SEND_BATCH, queue.end() - it);
+        std::partial_sort(it, middle, queue.end(), compare);
+
+        for(; it != middle && budget; it++) {
+            session->send_queue.erase(it->second);
+
+            // The chunk may have been unloaded since
+            const ServerChunk *sc = globals::chunks.find(it->second);
+            if(!sc || sc->state != ServerChunkState::READY || !session->loaded_chunks.count(it->second))
+                continue;
+
+            // The first chunk is sent even if it doesn't fit
+            budget -= std::min(budget, sendChunkVoxels(session, it->second, *sc));
+        }
+    }
+}
+
+// Simulation range is a cylinder: simulation_distance
+// chunks around the player horizontally and
+// simulation_height chunks above and below.
+static inline bool isInRange(const chunkpos_t &center, const chunkpos_t &cp)
+{
+    const int32_t radius = globals::config.simulation_distance;
+    const int32_t height = globals::config.simulation_height;
+    const chunkpos_t d = cp - center;
+    return d.x * d.x + d.z * d.z <= radius * radius && d.y >= -height && d.y <= height;
+}
+
+// Offsets of the range sorted by distance, so
+// the login loads the closest chunks first.
+static const std::vector<chunkpos_t> &getRangeOffsets()
+{
+    static std::vector<chunkpos_t> offsets;
+    if(offsets.empty()) {
+        const int32_t radius = globals::config.simulation_distance;
+        const int32_t height = globals::config.simulation_height;
+        for(int32_t x = -radius; x <= radius; x++) {
+            for(int32_t z = -radius; z <= radius; z++) {
+                for(int32_t y = -height; y <= height; y++) {
+                    if(isInRange(chunkpos_t(0, 0, 0), chunkpos_t(x, y, z)))
+                        offsets.push_back(chunkpos_t(x, y, z));
+                }
+            }
+        }
+
+        std::sort(offsets.begin(), offsets.end(), [](const chunkpos_t &a, const chunkpos_t &b) {
+            return a.x * a.x + a.y * a.y + a.z * a.z < b.x * b.x + b.y * b.y + b.z * b.z;
+        });
+    }
+
+    return offsets;
+}
+
+// Calls func for every chunk in range of center that is
+// not in range of other. Columns that are in both ranges
+// contribute only the vertical slabs they don't share.
+template<typename F>
+static void forEachExclusive(const chunkpos_t &center, const chunkpos_t &other, const F &func)
+{
+    const int32_t radius = globals::config.simulation_distance;
+    const int32_t height = globals::config.simulation_height;
+    for(int32_t x = -radius; x <= radius; x++) {
+        for(int32_t z = -radius; z <= radius; z++) {
+            if(x * x + z * z > radius * radius)
+                continue;
+
+            const int32_t cx = center.x + x;
+            const int32_t cz = center.z + z;
+            const int32_t ox = cx - other.x;
+            const int32_t oz = cz - other.z;
+
+            int32_t lo = center.y - height;
+            int32_t hi = center.y + height;
+            if(ox * ox + oz * oz <= radius * radius) {
+                // Skip the overlap with the other range
+                const int32_t other_lo = other.y - height;
+                const int32_t other_hi = other.y + height;
+                for(int32_t y = lo; y <= math::min(hi, other_lo - 1); y++)
+                    func(chunkpos_t(cx, y, cz));
+                lo = math::max(lo, other_hi + 1);
             }
 
-            session->state = SessionState::LOGGING_IN;
+            for(int32_t y = lo; y <= hi; y++)
+                func(chunkpos_t(cx, y, cz));
         }
-    },
-    {
-        protocol::packets::LoginStart::id,
-        [](const std::vector<uint8_t> &payload, ServerSession *session) {
-            protocol::packets::LoginStart packet;
-            protocol::deserialize(payload, packet);
+    }
+}
 
-            session->state = SessionState::RECEIVING_GAMEDATA;
-            session->username = packet.username;
+static void sendPlayerInfo(ServerSession *session, const ServerSession &other)
+{
+    protocol::packets::PlayerInfoEntry entryp = {};
+    entryp.session_id = other.id;
 
-            protocol::packets::LoginSuccess p = {};
-            p.session_id = session->id;
-            util::sendPacket(session->peer, p, 0, 0);
+    protocol::packets::PlayerInfoUsername namep = {};
+    namep.session_id = other.id;
+    namep.username = other.username;
 
-            //
-            // This little maneuver will cost us 50 server ticks
-            //
+    util::sendPacket(session->peer, entryp, 0, 0);
+    util::sendPacket(session->peer, namep, 0, 0);
+}
+
+static void sendPlayerEntity(ServerSession *session, const ServerSession &other)
+{
+    if(!globals::registry.valid(other.player_entity))
+        return;
+
+    protocol::packets::SpawnEntity spawnp = {};
+    spawnp.entity_id = static_cast<uint32_t>(other.player_entity);
+    spawnp.type = EntityType::PLAYER;
+
+    protocol::packets::UpdateCreature creaturep = {};
+    creaturep.entity_id = static_cast<uint32_t>(other.player_entity);
+    math::vecToArray(globals::registry.get<CreatureComponent>(other.player_entity).position, creaturep.position);
+
+    protocol::packets::UpdateHead headp = {};
+    headp.entity_id = static_cast<uint32_t>(other.player_entity);
+    math::vecToArray(globals::registry.get<HeadComponent>(other.player_entity).angles, headp.angles);
+
+    // Send stuff to the peer
+    util::sendPacket(session->peer, spawnp, 0, 0);
+    util::sendPacket(session->peer, creaturep, 0, 0);
+    util::sendPacket(session->peer, headp, 0, 0);
+
+    // Our own SpawnPlayer goes out at the very end
+    if(other.id != session->id) {
+        protocol::packets::SpawnPlayer playerp = {};
+        playerp.entity_id = static_cast<uint32_t>(other.player_entity);
+        playerp.session_id = other.id;
+        util::sendPacket(session->peer, playerp, 0, 0);
+    }
+}
 
-            for(VoxelDef::const_iterator it = globals::voxels.cbegin(); it != globals::voxels.cend(); it++) {
+// Does a bounded amount of the login work per tick
+// so players joining at once don't stall the server.
+static void updateGameData(ServerSession *session)
+{
+    if(!globals::registry.valid(session->player_entity))
+        return;
+
+    switch(session->gamedata_state) {
+        case ServerGameDataState::VOXEL_DEF: {
+            auto it = std::next(globals::voxels.cbegin(), session->gamedata_cursor);
+            for(size_t i = 0; i < LOGIN_VOXEL_DEFS && it != globals::voxels.cend(); i++, it++, session->gamedata_cursor++) {
                 protocol::packets::VoxelDefEntry entryp = {};
                 entryp.voxel = it->first;
                 entryp.type = it->second.type;
@@ -90,90 +330,134 @@ static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &,
                 }
             }
 
-            protocol::packets::VoxelDefChecksum checksump = {};
-            checksump.checksum = globals::voxels.getChecksum();
-            util::sendPacket(session->peer, checksump, 0, 0);
+            if(it == globals::voxels.cend()) {
+                protocol::packets::VoxelDefChecksum checksump = {};
+                checksump.checksum = globals::voxels.getChecksum();
+                util::sendPacket(session->peer, checksump, 0, 0);
+                session->gamedata_state = ServerGameDataState::CHUNK_DATA;
+                session->gamedata_cursor = 0;
+            }
 
-            session->player_entity = globals::registry.create();
-            globals::registry.emplace<CreatureComponent>(session->player_entity).position = FLOAT3_ZERO;
-            globals::registry.emplace<HeadComponent>(session->player_entity).angles = FLOAT2_ZERO;
+            break;
+        }
 
-            for(auto it = sessions.cbegin(); it != sessions.cend(); it++) {
-                protocol::packets::PlayerInfoEntry entryp = {};
-                entryp.session_id = it->first;
+        case ServerGameDataState::CHUNK_DATA: {
+            // Chunks that are not loaded yet are queued
+            // by sendChunk() as soon as they are ready.
+            const std::vector<chunkpos_t> &offsets = getRangeOffsets();
+            const chunkpos_t center = toChunkPos(globals::registry.get<CreatureComponent>(session->player_entity).position);
+            const size_t count = offsets.size();
+            for(size_t i = 0; i < LOGIN_CHUNKS && session->gamedata_cursor < count; i++, session->gamedata_cursor++) {
+                const chunkpos_t cp = center + offsets[session->gamedata_cursor];
+                if(session->loaded_chunks.insert(cp).second)
+                    queueChunk(session, cp, *globals::chunks.load(cp));
+            }
 
-                protocol::packets::PlayerInfoUsername namep = {};
-                namep.session_id = it->first;
-                namep.username = it->second.username;
-                
-                util::sendPacket(session->peer, entryp, 0, 0);
-                util::sendPacket(session->peer, namep, 0, 0);
-                
-                if(it->first == session->id) {
-                    util::broadcastPacket(globals::host, entryp, 0, 0, session->peer);
-                    util::broadcastPacket(globals::host, namep, 0, 0, session->peer);
+            if(session->gamedata_cursor >= count) {
+                // Players that are still joining announce
+                // themselves once they start playing.
+                session->gamedata_peers.clear();
+                for(auto it = sessions.cbegin(); it != sessions.cend(); it++) {
+                    if(it->first == session->id || it->second.state == SessionState::PLAYING)
+                        session->gamedata_peers.push_back(it->first);
                 }
+                session->gamedata_state = ServerGameDataState::PLAYER_INFO;
+                session->gamedata_cursor = 0;
+            }
+
+            break;
+        }
+
+        case ServerGameDataState::PLAYER_INFO:
+        case ServerGameDataState::ENTITIES: {
+            const bool entities = (session->gamedata_state == ServerGameDataState::ENTITIES);
+            for(size_t i = 0; i < LOGIN_PLAYERS && session->gamedata_cursor < session->gamedata_peers.size(); i++, session->gamedata_cursor++) {
+                // The other player may have left since
+                const ServerSession *other = network::findSession(session->gamedata_peers[session->gamedata_cursor]);
+                if(!other || (other != session && other->state != SessionState::PLAYING))
+                    continue;
+                if(entities)
+                    sendPlayerEntity(session, *other);
+                else
+                    sendPlayerInfo(session, *other);
+            }
 
-                if(globals::registry.valid(it->second.player_entity)) {
-                    protocol::packets::SpawnEntity spawnp = {};
-                    spawnp.entity_id = static_cast<uint32_t>(it->second.player_entity);
-                    spawnp.type = EntityType::PLAYER;
-
-                    protocol::packets::UpdateCreature creaturep = {};
-                    creaturep.entity_id = static_cast<uint32_t>(it->second.player_entity);
-                    math::vecToArray(globals::registry.get<CreatureComponent>(it->second.player_entity).position, creaturep.position);
-
-                    protocol::packets::UpdateHead headp = {};
-                    headp.entity_id = static_cast<uint32_t>(it->second.player_entity);
-                    math::vecToArray(globals::registry.get<HeadComponent>(it->second.player_entity).angles, headp.angles);
-
-                    // Send stuff to the peer
-                    util::sendPacket(session->peer, spawnp, 0, 0);
-                    util::sendPacket(session->peer, creaturep, 0, 0);
-                    util::sendPacket(session->peer, headp, 0, 0);
-
-                    // Broadcast our spawn to other players
-                    if(it->first == session->id) {
-                        util::broadcastPacket(globals::host, spawnp, 0, 0, session->peer);
-                        util::broadcastPacket(globals::host, creaturep, 0, 0, session->peer);
-                        util::broadcastPacket(globals::host, headp, 0, 0, session->peer);
-                    }
-
-                    if(it->first != session->id) {
-                        protocol::packets::SpawnPlayer playerp = {};
-                        playerp.entity_id = static_cast<uint32_t>(it->second.player_entity);
-                        playerp.session_id = it->first;
-                        util::sendPacket(session->peer, playerp, 0, 0);
-                    }
+            if(session->gamedata_cursor < session->gamedata_peers.size())
+                break;
+            session->gamedata_cursor = 0;
+
+            if(!entities) {
+                session->gamedata_state = ServerGameDataState::ENTITIES;
+                break;
+            }
+
+            // Announce ourselves to the players that took their
+            // snapshot of the peers before we started playing;
+            // everyone else is going to find us in theirs.
+            for(auto it = sessions.begin(); it != sessions.end(); it++) {
+                ServerSession *other = &it->second;
+                if(other == session)
+                    continue;
+                if(other->state == SessionState::PLAYING || (other->state == SessionState::RECEIVING_GAMEDATA && other->gamedata_state >= ServerGameDataState::PLAYER_INFO)) {
+                    sendPlayerInfo(other, *session);
+                    sendPlayerEntity(other, *session);
                 }
             }
 
-            // Notice that we send SpawnPlayer outside of the loop.
+            // Notice that we send SpawnPlayer at the very end.
             // The reason being client-side state machine that changes
             // it's state to PLAYING at the exact moment a SpawnPlayer
             // packet with owning session_id is occured.
             protocol::packets::SpawnPlayer playerp = {};
             playerp.entity_id = static_cast<uint32_t>(session->player_entity);
             playerp.session_id = session->id;
-            util::broadcastPacket(globals::host, playerp, 0, 0);
-
-            const int32_t sim_dist = globals::config.simulation_distance;
-            for(int32_t x = -sim_dist; x < sim_dist; x++) {
-                for(int32_t y = -sim_dist; y < sim_dist; y++) {
-                    for(int32_t z = -sim_dist; z < sim_dist; z++) {
-                        const chunkpos_t cp = chunkpos_t(x, y, z);
-                        if(ServerChunk *sc = globals::chunks.load(cp)) {
-                            session->loaded_chunks.insert(cp);
-                            protocol::packets::ChunkVoxels chunkp = {};
-                            math::vecToArray(cp, chunkp.position);
-                            chunkp.data = sc->data;
-                            util::sendPacket(session->peer, chunkp, 0, 0);
-                        }
-                    }
-                }
-            }
+            util::sendPacket(session->peer, playerp, 0, 0);
 
+            session->gamedata_peers.clear();
             session->state = SessionState::PLAYING;
+            break;
+        }
+    }
+}
+
+static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &, ServerSession *)> packet_handlers = {
+    {
+        protocol::packets::Handshake::id,
+        [](const std::vector<uint8_t> &payload, ServerSession *session) {
+            protocol::packets::Handshake packet;
+            protocol::deserialize(payload, packet);
+
+            if(packet.protocol_version != protocol::VERSION) {
+                network::kick(session, util::format("Protocol versions differ (server: %hu, client: %hu)", protocol::VERSION, packet.protocol_version));
+                return;
+            }
+
+            session->features = packet.features & protocol::FEATURES;
+            session->state = SessionState::LOGGING_IN;
+        }
+    },
+    {
+        protocol::packets::LoginStart::id,
+        [](const std::vector<uint8_t> &payload, ServerSession *session) {
+            protocol::packets::LoginStart packet;
+            protocol::deserialize(payload, packet);
+
+            session->state = SessionState::RECEIVING_GAMEDATA;
+            session->username = packet.username;
+
+            protocol::packets::LoginSuccess p = {};
+            p.session_id = session->id;
+            util::sendPacket(session->peer, p, 0, 0);
+
+            // The player entity exists from now on so the
+            // chunks can be streamed around it; the rest is
+            // sent over the next ticks by updateGameData().
+            session->player_entity = globals::registry.create();
+            globals::registry.emplace<CreatureComponent>(session->player_entity).position = FLOAT3_ZERO;
+            globals::registry.emplace<HeadComponent>(session->player_entity).angles = FLOAT2_ZERO;
+
+            session->gamedata_state = ServerGameDataState::VOXEL_DEF;
+            session->gamedata_cursor = 0;
         }
     },
     {
@@ -201,6 +485,13 @@ static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &,
 
             for(const chunkpos_t &cp : session->loaded_chunks)
                 globals::chunks.free(cp);
+            session->loaded_chunks.clear();
+            session->send_queue.clear();
+
+            // ENet delivers the disconnect event a few
+            // ticks later; the session is dead until then.
+            session->state = SessionState::DISCONNECTED;
+            session->player_entity = entt::null;
 
             enet_peer_disconnect(session->peer, 0);
         }
@@ -220,41 +511,22 @@ static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &,
                 if(entity == session->player_entity && new_cp != old_cp) {
                     spdlog::info("PLM: [{}, {}, {}] -> [{}, {}, {}]", old_cp.x, old_cp.y, old_cp.z, new_cp.x, new_cp.y, new_cp.z);
 
-                    // Build ranges
-                    const int32_t sim_dist = globals::config.simulation_distance;
-                    std::unordered_set<chunkpos_t> old_range, new_range;
-                    for(int32_t x = -sim_dist; x < sim_dist; x++) {
-                        for(int32_t y = -sim_dist; y < sim_dist; y++) {
-                            for(int32_t z = -sim_dist; z < sim_dist; z++) {
-                                old_range.insert(old_cp + chunkpos_t(x, y, z));
-                                new_range.insert(new_cp + chunkpos_t(x, y, z));
-                            }
-                        }
-                    }
-
-                    std::unordered_set<chunkpos_t> to_free, to_load;
-                    for(const chunkpos_t &icp : old_range) {
-                        const auto it = new_range.find(icp);
-                        (*((it != new_range.cend()) ? &to_load : &to_free)).insert(icp);
-                    }
-
-                    for(const chunkpos_t &icp : to_load) {
-                        if(ServerChunk *sc = globals::chunks.load(icp)) {
-                            protocol::packets::ChunkVoxels loadp = {};
-                            math::vecToArray(icp, loadp.position);
-                            loadp.data = sc->data;
-                            util::sendPacket(session->peer, loadp, 0, 0);
-                            session->loaded_chunks.insert(icp);
-                        }
-                    }
-
-                    for(const chunkpos_t &icp : to_free) {
+                    // Only the slabs that enter or leave the range
+                    // are touched; held chunks are never sent again.
+                    forEachExclusive(new_cp, old_cp, [session](const chunkpos_t &icp) {
+                        if(session->loaded_chunks.insert(icp).second)
+                            queueChunk(session, icp, *globals::chunks.load(icp));
+                    });
+
+                    forEachExclusive(old_cp, new_cp, [session](const chunkpos_t &icp) {
+                        if(!session->loaded_chunks.erase(icp))
+                            return;
                         protocol::packets::UnloadChunk unloadp = {};
                         math::vecToArray(icp, unloadp.position);
                         //util::sendPacket(session->peer, unloadp, 0, 0);
                         globals::chunks.free(icp);
-                        session->loaded_chunks.erase(icp);
-                    }
+                        session->send_queue.erase(icp);
+                    });
                 }
 
                 util::broadcastPacket(globals::host, packet, 0, 0, session->peer);
@@ -266,6 +538,9 @@ static const std::unordered_map<uint16_t, void(*)(const std::vector<uint8_t> &,
         [](const std::vector<uint8_t> &payload, ServerSession *session) {
             protocol::packets::UpdateHead packet;
             protocol::deserialize(payload, packet);
+            entt::entity entity = static_cast<entt::entity>(packet.entity_id);
+            if(globals::registry.valid(entity))
+                globals::registry.get_or_emplace<HeadComponent>(entity).angles = math::arrayToVec<float2>(packet.angles);
             util::broadcastPacket(globals::host, packet, 0, 0, session->peer);
         }
     }
@@ -286,6 +561,13 @@ void sv_network::init()
 
 void sv_network::shutdown()
 {
+    if(chunk_stats.count) {
+        const float count = static_cast<float>(chunk_stats.count);
+        spdlog::info("Chunk packets: {} sent, {} encoded, {:.0f} bytes per chunk ({:.1f}% of raw), {:.2f} us per encode", chunk_stats.count, chunk_stats.encoded,
+            static_cast<float>(chunk_stats.wire_bytes) / count, 100.0f * static_cast<float>(chunk_stats.wire_bytes) / static_cast<float>(chunk_stats.raw_bytes),
+            util::seconds<float>(chunk_stats.encode_time) * 1.0e6f / static_cast<float>(math::max<size_t>(chunk_stats.encoded, 1)));
+    }
+
     network::kickAll("Server shutting down.");
     enet_host_destroy(globals::host);
     globals::host = nullptr;
@@ -330,6 +612,12 @@ void sv_network::update()
             it->second(payload, session);
         }
     }
+
+    for(auto it = sessions.begin(); it != sessions.end(); it++) {
+        if(it->second.state == SessionState::RECEIVING_GAMEDATA)
+            updateGameData(&it->second);
+        sendQueuedChunks(&it->second);
+    }
 }
 
 ServerSession *sv_network::createSession()
@@ -361,6 +649,14 @@ void sv_network::destroySession(ServerSession *session)
     }
 }
 
+void sv_network::sendChunk(const chunkpos_t &cp, const ServerChunk &sc)
+{
+    for(auto it = sessions.begin(); it != sessions.end(); it++) {
+        if(it->second.loaded_chunks.count(cp))
+            queueChunk(&it->second, cp, sc);
+    }
+}
+
 void sv_network::kick(ServerSession *session, const std::string &reason)
 {
     if(session) {
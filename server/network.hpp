@@ -6,6 +6,8 @@
 #pragma once
 #include <shared/session.hpp>
 
+struct ServerChunk;
+
 namespace sv_network
 {
 void init();
@@ -14,6 +16,7 @@ void update();
 ServerSession *createSession();
 ServerSession *findSession(uint32_t session_id);
 void destroySession(ServerSession *session);
+void sendChunk(const chunkpos_t &cp, const ServerChunk &sc);
 void kick(ServerSession *session, const std::string &reason);
 void kickAll(const std::string &reason);
 } // namespace sv_network
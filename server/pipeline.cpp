@@ -0,0 +1,223 @@
+/*
+ * pipeline.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <server/pipeline.hpp>
+#include <thread_pool.hpp>
+
+static inline GeneratorStage previousStage(GeneratorStage stage)
+{
+    return static_cast<GeneratorStage>(static_cast<int>(stage) - 1);
+}
+
+void GeneratorPipeline::init(Generator *generator, thread_pool *threads, size_t budget)
+{
+    this->generator = generator;
+    this->threads = threads;
+    this->budget = budget;
+    final_stage = (generator->getFlags() & GENERATOR_STAGED) ? GeneratorStage::FEATURES : GeneratorStage::TERRAIN;
+}
+
+void GeneratorPipeline::shutdown()
+{
+    // The worker pool must be idle by now
+    protos.clear();
+    lru.clear();
+    memory_usage = 0;
+    pending.clear();
+    finished.clear();
+    completed.clear();
+}
+
+void GeneratorPipeline::request(const chunkpos_t &cp)
+{
+    changed = pending.insert(cp).second || changed;
+}
+
+void GeneratorPipeline::update()
+{
+    std::deque<StageResult> results;
+    {
+        std::scoped_lock lock(mutex);
+        results.swap(completed);
+    }
+
+    for(StageResult &result : results) {
+        // Busy chunks are never evicted
+        ProtoChunk &proto = protos.at(result.position);
+        proto.stage = result.stage;
+        proto.busy = false;
+        proto.memory += result.data->getMemoryUsage();
+        memory_usage += result.data->getMemoryUsage();
+        proto.data[static_cast<size_t>(result.stage)] = std::move(result.data);
+        changed = true;
+    }
+
+    if(!changed)
+        return;
+    changed = false;
+    pass++;
+
+    for(auto it = pending.begin(); it != pending.end();) {
+        if(!advance(*it, final_stage)) {
+            ++it;
+            continue;
+        }
+
+        const VoxelStorage &data = *protos.at(*it).data[static_cast<size_t>(final_stage)];
+
+        GeneratorResult result = {};
+        result.position = *it;
+        result.generated = !data.isUniform() || data.getUniform() != NULL_VOXEL;
+        result.data = data;
+        finished.push_back(std::move(result));
+
+        it = pending.erase(it);
+    }
+
+    evict();
+}
+
+bool GeneratorPipeline::poll(GeneratorResult &result)
+{
+    if(finished.empty())
+        return false;
+    result = std::move(finished.front());
+    finished.pop_front();
+    return true;
+}
+
+size_t GeneratorPipeline::getPendingCount() const
+{
+    return pending.size();
+}
+
+size_t GeneratorPipeline::getProtoCount() const
+{
+    return protos.size();
+}
+
+size_t GeneratorPipeline::getMemoryUsage() const
+{
+    return memory_usage;
+}
+
+bool GeneratorPipeline::advance(const chunkpos_t &cp, GeneratorStage stage)
+{
+    auto it = protos.find(cp);
+    if(it == protos.end()) {
+        ProtoChunk proto = {};
+        proto.stage = GeneratorStage::NONE;
+        proto.memory = sizeof(ProtoChunk);
+        memory_usage += proto.memory;
+        lru.push_front(cp);
+        proto.lru_it = lru.begin();
+        it = protos.emplace(cp, std::move(proto)).first;
+    }
+
+    // References to the elements stay valid while
+    // the recursion below inserts the neighbours.
+    ProtoChunk &proto = it->second;
+    proto.pass = pass;
+    lru.splice(lru.begin(), lru, proto.lru_it);
+
+    if(proto.stage >= stage)
+        return true;
+    if(proto.busy)
+        return false;
+
+    // Each stage is checked once per pass: whatever
+    // it waits for has been scheduled the first time.
+    const unsigned int stage_bit = 1U << static_cast<unsigned int>(stage);
+    if(proto.checked_pass != pass) {
+        proto.checked_pass = pass;
+        proto.checked_stages = 0;
+    }
+
+    if(proto.checked_stages & stage_bit)
+        return false;
+    proto.checked_stages |= stage_bit;
+
+    bool ready = true;
+    if(stage != GeneratorStage::TERRAIN) {
+        const GeneratorStage previous = previousStage(stage);
+        for(int32_t x = -1; x <= 1; x++) {
+            for(int32_t z = -1; z <= 1; z++) {
+                for(int32_t y = -1; y <= 1; y++) {
+                    ready = advance(cp + chunkpos_t(x, y, z), previous) && ready;
+                }
+            }
+        }
+    }
+
+    if(ready && !proto.busy && proto.stage == previousStage(stage))
+        schedule(cp, proto, stage);
+    return false;
+}
+
+void GeneratorPipeline::schedule(const chunkpos_t &cp, ProtoChunk &proto, GeneratorStage stage)
+{
+    GeneratorNeighbourhood around = {};
+    if(stage != GeneratorStage::TERRAIN) {
+        const size_t previous = static_cast<size_t>(previousStage(stage));
+        for(int32_t x = -1, i = 0; x <= 1; x++) {
+            for(int32_t z = -1; z <= 1; z++) {
+                for(int32_t y = -1; y <= 1; y++, i++) {
+                    around.chunks[i] = protos.at(cp + chunkpos_t(x, y, z)).data[previous];
+                }
+            }
+        }
+    }
+
+    proto.busy = true;
+    threads->push_task([this, cp, stage, around = std::move(around)]() {
+        std::unique_lock<std::mutex> serial_lock(serial_mutex, std::defer_lock);
+        if(!(generator->getFlags() & GENERATOR_CONCURRENT))
+            serial_lock.lock();
+
+        VoxelStorage data;
+        switch(stage) {
+            case GeneratorStage::TERRAIN:
+                if(!generator->generate(cp, data))
+                    data.fill(NULL_VOXEL);
+                break;
+            case GeneratorStage::SURFACE:
+                data = *around.chunks[13];
+                generator->surface(cp, around, data);
+                break;
+            case GeneratorStage::FEATURES:
+                data = *around.chunks[13];
+                generator->decorate(cp, around, data);
+                break;
+            default:
+                break;
+        }
+
+        if(serial_lock.owns_lock())
+            serial_lock.unlock();
+
+        StageResult result = {};
+        result.position = cp;
+        result.stage = stage;
+        result.data = std::make_shared<const VoxelStorage>(std::move(data));
+
+        std::scoped_lock lock(mutex);
+        completed.push_back(std::move(result));
+    });
+}
+
+void GeneratorPipeline::evict()
+{
+    // Chunks touched during this pass are needed by
+    // the pending requests and the LRU order puts them
+    // in front of everything else.
+    while(!lru.empty() && (protos.size() > PROTO_CACHE_SIZE || memory_usage > budget)) {
+        const auto it = protos.find(lru.back());
+        if(it->second.busy || it->second.pass == pass)
+            break;
+        memory_usage -= it->second.memory;
+        lru.pop_back();
+        protos.erase(it);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * pipeline.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <common/traits.hpp>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <server/generator.hpp>
+#include <unordered_map>
+#include <unordered_set>
+
+class thread_pool;
+
+// Chunks in the intermediate stages that are
+// not needed by any request are dropped in the
+// LRU order past this number or past the memory
+// budget given to the pipeline.
+constexpr static const size_t PROTO_CACHE_SIZE = 4096;
+
+struct GeneratorResult final {
+    chunkpos_t position;
+    bool generated;
+    VoxelStorage data;
+};
+
+// A chunk on its way through the generator stages.
+// Data of each finished stage is kept as is since
+// the neighbours read the previous stage of it.
+struct ProtoChunk final {
+    GeneratorStage stage;
+    bool busy;
+    uint64_t pass;
+    uint64_t checked_pass;
+    unsigned int checked_stages;
+    size_t memory;
+    std::array<std::shared_ptr<const VoxelStorage>, 4> data;
+    std::list<chunkpos_t>::iterator lru_it;
+};
+
+// Schedules the generator stages on the worker pool.
+// Each stage task reads immutable data of the previous
+// stage and writes only its own chunk so tasks of any
+// chunks can run in parallel. Intermediate chunks depend
+// only on the seed and are regenerated if dropped.
+class GeneratorPipeline final : public NonCopyable {
+public:
+    // The memory budget is shared with the chunk
+    // cache which counts getMemoryUsage() against it.
+    void init(Generator *generator, thread_pool *threads, size_t budget);
+    void shutdown();
+
+    // The result shows up in poll() after one
+    // of the next updates. Main thread only.
+    void request(const chunkpos_t &cp);
+    void update();
+    bool poll(GeneratorResult &result);
+
+    size_t getPendingCount() const;
+    size_t getProtoCount() const;
+    size_t getMemoryUsage() const;
+
+private:
+    // Returns true if the chunk has reached the stage,
+    // schedules whatever it is waiting for otherwise.
+    bool advance(const chunkpos_t &cp, GeneratorStage stage);
+    void schedule(const chunkpos_t &cp, ProtoChunk &proto, GeneratorStage stage);
+    void evict();
+
+private:
+    struct StageResult final {
+        chunkpos_t position;
+        GeneratorStage stage;
+        std::shared_ptr<const VoxelStorage> data;
+    };
+
+    Generator *generator { nullptr };
+    thread_pool *threads { nullptr };
+    GeneratorStage final_stage { GeneratorStage::TERRAIN };
+    uint64_t pass { 0 };
+    bool changed { false };
+    size_t budget { 0 };
+    size_t memory_usage { 0 };
+    std::unordered_map<chunkpos_t, ProtoChunk> protos;
+    std::list<chunkpos_t> lru;
+    std::unordered_set<chunkpos_t> pending;
+    std::deque<GeneratorResult> finished;
+    std::mutex serial_mutex;
+    std::mutex mutex;
+    std::deque<StageResult> completed;
+};
@@ -0,0 +1,111 @@
+/*
+ * pregen.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <common/util/clock.hpp>
+#include <map>
+#include <server/chunks.hpp>
+#include <server/globals.hpp>
+#include <server/pregen.hpp>
+#include <server/region.hpp>
+#include <spdlog/spdlog.h>
+#include <thread>
+#include <vector>
+
+struct PregenStats final {
+    size_t total { 0 };
+    size_t stored { 0 };
+    size_t generated { 0 };
+    size_t empty { 0 };
+};
+
+// Throughput counts every chunk that is done, stored and
+// empty ones included, so it's live within a region too.
+static void logProgress(const PregenStats &stats, size_t done, float seconds)
+{
+    spdlog::info("pregen: {}/{} chunks ({:.1f}%), {:.1f} chunks/s", done, stats.total, 100.0f * static_cast<float>(done) / static_cast<float>(stats.total), static_cast<float>(done) / seconds);
+}
+
+void sv_pregen::run(int32_t radius)
+{
+    globals::chunks.init();
+
+    // The whole point is to have them on disk
+    ServerChunkManager &chunks = globals::chunks;
+    if(!chunks.config.save_generated)
+        spdlog::warn("pregen: storing generated chunks despite save_generated = false");
+    chunks.config.save_generated = true;
+
+    // Columns are grouped by region: each group is
+    // generated in parallel and then written in one go.
+    std::map<std::pair<int32_t, int32_t>, std::vector<chunkpos_t>> regions;
+    for(int32_t x = -radius; x <= radius; x++) {
+        for(int32_t z = -radius; z <= radius; z++) {
+            if(x * x + z * z > radius * radius)
+                continue;
+            std::vector<chunkpos_t> &region = regions[std::make_pair(x >> REGION_BITSHIFT, z >> REGION_BITSHIFT)];
+            for(int32_t y = chunks.config.base; y <= chunks.config.base + chunks.config.height; y++)
+                region.push_back(chunkpos_t(x, y, z));
+        }
+    }
+
+    PregenStats stats;
+    for(const auto &it : regions)
+        stats.total += it.second.size();
+    spdlog::info("pregen: {} chunks in {} region columns within {} chunks of the spawn", stats.total, regions.size(), radius);
+
+    ChronoClock<std::chrono::steady_clock> clock;
+    ChronoClock<std::chrono::steady_clock> progress_clock;
+    size_t done = 0;
+
+    for(const auto &it : regions) {
+        if(!globals::running)
+            break;
+
+        std::vector<ServerChunk *> loaded;
+        for(const chunkpos_t &cp : it.second)
+            loaded.push_back(chunks.load(cp));
+
+        // Keep going after SIGINT: the chunks in
+        // flight are saved so nothing is lost.
+        for(size_t pending = loaded.size(); pending;) {
+            chunks.update();
+
+            pending = 0;
+            for(const ServerChunk *sc : loaded) {
+                if(sc->state == ServerChunkState::LOADING || sc->state == ServerChunkState::GENERATING)
+                    pending++;
+            }
+
+            if(progress_clock.elapsed() >= std::chrono::seconds(1)) {
+                logProgress(stats, done + loaded.size() - pending, util::seconds<float>(clock.elapsed()));
+                progress_clock.restart();
+            }
+
+            if(pending)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        for(size_t i = 0; i < loaded.size(); i++) {
+            if(loaded[i]->state == ServerChunkState::EMPTY)
+                stats.empty++;
+            else if(loaded[i]->dirty)
+                stats.generated++;
+            else
+                stats.stored++;
+            chunks.free(it.second[i]);
+        }
+
+        done += loaded.size();
+        chunks.save();
+    }
+
+    const float seconds = util::seconds<float>(clock.elapsed());
+    if(done < stats.total)
+        spdlog::warn("pregen: interrupted, run again to resume");
+    logProgress(stats, done, seconds);
+    spdlog::info("pregen: {} generated, {} already stored, {} empty in {:.2f} s", stats.generated, stats.stored, stats.empty, seconds);
+
+    globals::chunks.shutdown();
+}
@@ -0,0 +1,19 @@
+/*
+ * pregen.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <cstdint>
+
+// Generates and stores the chunk columns within
+// the radius (in chunks) around the spawn. Run with
+// "vgameds --pregen <radius>" instead of the server.
+// Chunks that are already stored or known to be empty
+// are skipped so an interrupted run can be resumed.
+namespace sv_pregen
+{
+void run(int32_t radius);
+} // namespace sv_pregen
+
+namespace pregen = sv_pregen;
@@ -0,0 +1,315 @@
+/*
+ * region.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <cstdio>
+#include <server/region.hpp>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+constexpr static const size_t MAX_OPEN_REGIONS = 64;
+
+struct RegionHeader final {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+};
+
+constexpr static const size_t TABLE_OFFSET = sizeof(RegionHeader);
+constexpr static const size_t HEADER_SIZE = TABLE_OFFSET + REGION_VOLUME * sizeof(RegionFile::Entry);
+constexpr static const uint32_t HEADER_SECTORS = static_cast<uint32_t>((HEADER_SIZE + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE);
+
+static inline const uint32_t sectorCount(size_t size)
+{
+    return static_cast<uint32_t>((size + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE);
+}
+
+RegionFile::~RegionFile()
+{
+    close();
+}
+
+bool RegionFile::open(const stdfs::path &path, bool create)
+{
+    close();
+
+    if(!stdfs::exists(path)) {
+        if(!create)
+            return false;
+
+        std::ofstream ofs(path, std::ios::binary);
+        if(!ofs.is_open())
+            return false;
+
+        std::vector<uint8_t> header(HEADER_SECTORS * REGION_SECTOR_SIZE, 0);
+        RegionHeader *hp = reinterpret_cast<RegionHeader *>(header.data());
+        hp->magic = REGION_MAGIC;
+        hp->version = REGION_VERSION;
+        hp->flags = 0;
+        ofs.write(reinterpret_cast<const char *>(header.data()), header.size());
+        ofs.close();
+    }
+
+    file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if(!file.is_open())
+        return false;
+    this->path = path;
+
+    RegionHeader header = {};
+    table.assign(REGION_VOLUME, Entry { 0, 0 });
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    file.read(reinterpret_cast<char *>(table.data()), table.size() * sizeof(Entry));
+    if(!file || header.magic != REGION_MAGIC || header.version != REGION_VERSION) {
+        spdlog::warn("{}: invalid region header", path.string());
+        close();
+        return false;
+    }
+
+    sectors.assign(HEADER_SECTORS, true);
+    for(const Entry &entry : table) {
+        if(entry.size) {
+            const uint32_t end = entry.sector + sectorCount(entry.size);
+            if(sectors.size() < end)
+                sectors.resize(end, false);
+            std::fill(sectors.begin() + entry.sector, sectors.begin() + end, true);
+        }
+    }
+
+    return true;
+}
+
+void RegionFile::close()
+{
+    if(file.is_open()) {
+        sync();
+        file.close();
+    }
+
+    view.close();
+    unflushed = false;
+    unsynced = false;
+    table.clear();
+    sectors.clear();
+}
+
+void RegionFile::flush()
+{
+    file.flush();
+    unflushed = false;
+}
+
+bool RegionFile::sync()
+{
+    if(!unsynced)
+        return true;
+    flush();
+    unsynced = false;
+    return file.good() && fs::syncFile(path);
+}
+
+bool RegionFile::contains(regionidx_t idx) const
+{
+    return table[idx].size != 0;
+}
+
+bool RegionFile::read(regionidx_t idx, const uint8_t *&data, size_t &size)
+{
+    const Entry &entry = table[idx];
+    if(!entry.size)
+        return false;
+
+    // The mapping shares the page cache with the
+    // stream so flushing is enough to see in-place
+    // writes; records appended past the end of the
+    // mapping require the file to be mapped again.
+    if(unflushed)
+        flush();
+
+    const size_t offset = static_cast<size_t>(entry.sector) * REGION_SECTOR_SIZE;
+    if(offset + entry.size > view.size() && !view.open(path))
+        return false;
+    if(offset + entry.size > view.size())
+        return false;
+
+    data = view.data() + offset;
+    size = entry.size;
+    return true;
+}
+
+bool RegionFile::write(regionidx_t idx, const std::vector<uint8_t> &buffer)
+{
+    Entry &entry = table[idx];
+    const uint32_t old_count = sectorCount(entry.size);
+    const uint32_t new_count = sectorCount(buffer.size());
+
+    if(new_count > old_count) {
+        release(entry.sector, old_count);
+        entry.sector = allocate(new_count);
+    }
+    else if(new_count < old_count) {
+        release(entry.sector + new_count, old_count - new_count);
+    }
+
+    if(new_count) {
+        // Pad the record to the sector boundary so the
+        // file never ends in the middle of a sector.
+        static const char zeros[REGION_SECTOR_SIZE] = {};
+        file.seekp(static_cast<std::streamoff>(entry.sector) * REGION_SECTOR_SIZE);
+        file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+        file.write(zeros, new_count * REGION_SECTOR_SIZE - buffer.size());
+    }
+
+    entry.size = static_cast<uint32_t>(buffer.size());
+    if(!entry.size)
+        entry.sector = 0;
+
+    // Update the table after the record itself so
+    // a partial write never points to garbage.
+    file.seekp(TABLE_OFFSET + idx * sizeof(Entry));
+    file.write(reinterpret_cast<const char *>(&entry), sizeof(Entry));
+    unflushed = true;
+    unsynced = true;
+
+    if(!file) {
+        file.clear();
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t RegionFile::allocate(uint32_t count)
+{
+    // First fit
+    uint32_t run = 0;
+    for(uint32_t i = HEADER_SECTORS; i < sectors.size(); i++) {
+        run = sectors[i] ? 0 : run + 1;
+        if(run == count) {
+            const uint32_t sector = i - count + 1;
+            std::fill(sectors.begin() + sector, sectors.begin() + sector + count, true);
+            return sector;
+        }
+    }
+
+    // Append (possibly reusing a free tail)
+    const uint32_t sector = static_cast<uint32_t>(sectors.size()) - run;
+    sectors.resize(sector + count, true);
+    std::fill(sectors.begin() + sector, sectors.end(), true);
+    return sector;
+}
+
+void RegionFile::release(uint32_t sector, uint32_t count)
+{
+    if(count)
+        std::fill(sectors.begin() + sector, sectors.begin() + sector + count, false);
+}
+
+void RegionStorage::init(const stdfs::path &dir)
+{
+    this->dir = fs::getWritePath(dir);
+    stdfs::create_directories(this->dir);
+}
+
+void RegionStorage::shutdown()
+{
+    regions.clear();
+}
+
+void RegionStorage::flush()
+{
+    for(auto &it : regions)
+        it.second.second->flush();
+}
+
+bool RegionStorage::sync()
+{
+    bool result = !sync_failed;
+    for(auto &it : regions)
+        result = it.second.second->sync() && result;
+    sync_failed = false;
+    return result;
+}
+
+bool RegionStorage::read(const chunkpos_t &cp, const uint8_t *&data, size_t &size)
+{
+    if(RegionFile *region = find(toRegionPos(cp), false))
+        return region->read(toRegionIdx(cp), data, size);
+    return false;
+}
+
+bool RegionStorage::write(const chunkpos_t &cp, const std::vector<uint8_t> &buffer)
+{
+    if(RegionFile *region = find(toRegionPos(cp), true))
+        return region->write(toRegionIdx(cp), buffer);
+    return false;
+}
+
+size_t RegionStorage::migrate(const stdfs::path &legacy_dir)
+{
+    const stdfs::path full_path = fs::getWritePath(legacy_dir);
+    if(!stdfs::is_directory(full_path))
+        return 0;
+
+    size_t count = 0;
+    voxel_array_t array;
+    for(const stdfs::directory_entry &it : stdfs::directory_iterator(full_path)) {
+        chunkpos_t cp;
+        const std::string filename = it.path().filename().string();
+        if(!it.is_regular_file() || std::sscanf(filename.c_str(), "c_%d_%d_%d", &cp.x, &cp.y, &cp.z) != 3)
+            continue;
+
+        // Legacy chunks are raw voxel dumps
+        array.fill(NULL_VOXEL);
+        if(!fs::readBytes(legacy_dir / filename, array.data(), sizeof(voxel_t) * CHUNK_VOLUME)) {
+            spdlog::warn("Unable to read {}", filename);
+            continue;
+        }
+
+        const std::vector<uint8_t> buffer = std::vector<uint8_t>(array.cbegin(), array.cend());
+        if(!write(cp, buffer)) {
+            spdlog::warn("Unable to migrate {}", filename);
+            continue;
+        }
+
+        stdfs::remove(it.path());
+        count++;
+    }
+
+    if(stdfs::is_empty(full_path))
+        stdfs::remove(full_path);
+    flush();
+
+    return count;
+}
+
+RegionFile *RegionStorage::find(const regionpos_t &rp, bool create)
+{
+    const auto it = regions.find(rp);
+    if(it != regions.cend()) {
+        it->second.first = ++use_counter;
+        return it->second.second.get();
+    }
+
+    std::unique_ptr<RegionFile> region = std::make_unique<RegionFile>();
+    if(!region->open(dir / fmt::format("r_{}_{}_{}", rp.x, rp.y, rp.z), create))
+        return nullptr;
+
+    if(regions.size() >= MAX_OPEN_REGIONS) {
+        auto lru = regions.begin();
+        for(auto jt = regions.begin(); jt != regions.end(); jt++) {
+            if(jt->second.first < lru->second.first)
+                lru = jt;
+        }
+
+        // The next sync() reports it
+        if(!lru->second.second->sync())
+            sync_failed = true;
+        regions.erase(lru);
+    }
+
+    auto &slot = regions[rp];
+    slot.first = ++use_counter;
+    slot.second = std::move(region);
+    return slot.second.get();
+}
@@ -0,0 +1,110 @@
+/*
+ * region.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <common/filesystem.hpp>
+#include <common/traits.hpp>
+#include <memory>
+#include <shared/world.hpp>
+#include <unordered_map>
+
+constexpr static const size_t REGION_SIZE = 16;
+constexpr static const size_t REGION_VOLUME = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+constexpr static const size_t REGION_BITSHIFT = math::log2(REGION_SIZE);
+constexpr static const size_t REGION_SECTOR_SIZE = 256;
+constexpr static const uint32_t REGION_MAGIC = 0x47525856; // 'VXRG'
+constexpr static const uint16_t REGION_VERSION = 1;
+
+using regionpos_t = chunkpos_t;
+using regionidx_t = size_t;
+
+constexpr static inline const regionpos_t toRegionPos(const chunkpos_t &cp)
+{
+    return regionpos_t(cp.x >> REGION_BITSHIFT, cp.y >> REGION_BITSHIFT, cp.z >> REGION_BITSHIFT);
+}
+
+constexpr static inline const regionidx_t toRegionIdx(const chunkpos_t &cp)
+{
+    // Same ordering as toVoxelIdx() so a vertical
+    // column of chunks ends up next to each other.
+    constexpr const int32_t mask = static_cast<int32_t>(REGION_SIZE - 1);
+    return static_cast<regionidx_t>(((cp.x & mask) * REGION_SIZE + (cp.z & mask)) * REGION_SIZE + (cp.y & mask));
+}
+
+// A region file packs REGION_VOLUME chunks into a
+// single file: a fixed header with an offset table
+// followed by the chunk records aligned to sectors.
+// Records are re-allocated only when they outgrow
+// their current run of sectors.
+class RegionFile final : public NonCopyable {
+public:
+    struct Entry final {
+        uint32_t sector;
+        uint32_t size;
+    };
+
+public:
+    ~RegionFile();
+
+    bool open(const stdfs::path &path, bool create);
+    void close();
+    void flush();
+
+    // Flushes and makes the writes durable.
+    // Does nothing if nothing was written.
+    bool sync();
+
+    bool contains(regionidx_t idx) const;
+    bool write(regionidx_t idx, const std::vector<uint8_t> &buffer);
+
+    // Returns a pointer into the memory-mapped file. It
+    // stays valid until the next call into this object:
+    // writes move records and reads may remap the file.
+    bool read(regionidx_t idx, const uint8_t *&data, size_t &size);
+
+private:
+    uint32_t allocate(uint32_t count);
+    void release(uint32_t sector, uint32_t count);
+
+private:
+    stdfs::path path;
+    bool unflushed { false };
+    bool unsynced { false };
+    fs::MappedFile view;
+    std::fstream file;
+    std::vector<Entry> table;
+    std::vector<bool> sectors;
+};
+
+class RegionStorage final {
+public:
+    void init(const stdfs::path &dir);
+    void shutdown();
+    void flush();
+
+    // Makes every write so far durable, including the
+    // ones to regions that were closed since the last
+    // call. Returns false if any of them failed.
+    bool sync();
+
+    // The data points into a region mapping and stays
+    // valid only until the next call into the storage:
+    // any call may remap or close (LRU) the region.
+    bool read(const chunkpos_t &cp, const uint8_t *&data, size_t &size);
+    bool write(const chunkpos_t &cp, const std::vector<uint8_t> &buffer);
+
+    // Imports legacy one-file-per-chunk storage
+    // (c_{cx}_{cy}_{cz} files) into region files.
+    size_t migrate(const stdfs::path &legacy_dir);
+
+private:
+    RegionFile *find(const regionpos_t &rp, bool create);
+
+private:
+    stdfs::path dir;
+    uint64_t use_counter { 0 };
+    bool sync_failed { false };
+    std::unordered_map<regionpos_t, std::pair<uint64_t, std::unique_ptr<RegionFile>>> regions;
+};
@@ -4,11 +4,15 @@
  * All Rights Reserved.
  */
 #include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <server/bench.hpp>
 #include <server/config.hpp>
 #include <server/game.hpp>
 #include <server/globals.hpp>
 #include <server/server_app.hpp>
 #include <server/network.hpp>
+#include <server/pregen.hpp>
 #include <shared/protocol/protocol.hpp>
 #include <common/util/clock.hpp>
 #include <spdlog/spdlog.h>
@@ -22,14 +26,34 @@ static void onSIGINT(int)
     globals::running = false;
 }
 
-void server_app::run()
+void server_app::run(int argc, char **argv)
 {
+    int32_t pregen_radius = -1;
+    for(int i = 1; i < argc; i++) {
+        if(!std::strcmp(argv[i], "--bench")) {
+            bench::run();
+            return;
+        }
+
+        if(!std::strcmp(argv[i], "--pregen")) {
+            if(i + 1 >= argc || (pregen_radius = std::atoi(argv[++i])) < 0) {
+                spdlog::error("Usage: --pregen <radius in chunks>");
+                return;
+            }
+        }
+    }
+
     globals::config.read("server.toml");
 
     globals::running = true;
 
     std::signal(SIGINT, &onSIGINT);
 
+    if(pregen_radius >= 0) {
+        pregen::run(pregen_radius);
+        return;
+    }
+
     network::init();
     game::init();
     
@@ -7,5 +7,5 @@
 
 namespace server_app
 {
-void run();
+void run(int argc, char **argv);
 } // namespace server_app
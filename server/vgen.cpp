@@ -3,43 +3,87 @@
  * Author: Kirill GPRB
  * Created: Sun Dec 12 2021 23:39:48
  */
+#include <common/math/noise.hpp>
 #include <common/math/types.hpp>
-#include <glm/gtc/noise.hpp>
 #include <server/chunks.hpp>
 #include <server/vgen.hpp>
+#include <spdlog/spdlog.h>
 
-static inline float octanoise(const double3 &v, unsigned int oct)
+constexpr static const voxel_t VGEN_STONE = 0x01;
+constexpr static const voxel_t VGEN_DIRT = 0x02;
+constexpr static const voxel_t VGEN_GRASS = 0x03;
+
+// Grass and dirt layers on top of the stone
+constexpr static const int32_t VGEN_SURFACE_DEPTH = 4;
+
+// Boulders are smaller than a chunk so only the
+// neighbours can place them into a chunk.
+constexpr static const int32_t VGEN_BOULDER_RADIUS = 3;
+
+// Batched version of what used to be computed one column
+// at a time as (1 + sum(perlin(v / i))) / (oct + 1).
+static inline void octanoise(const double3 &origin, const double3 &step, unsigned int oct, std::array<float, CHUNK_AREA> &out)
 {
-    double result = 1.0;
-    for(unsigned int i = 1; i <= oct; i++)
-        result += glm::perlin(v / static_cast<double>(i));
-    return static_cast<float>(result / static_cast<double>(oct + 1));
+    std::array<float, CHUNK_AREA> octave;
+    out.fill(1.0f);
+    for(unsigned int i = 1; i <= oct; i++) {
+        const double scale = static_cast<double>(i);
+        math::perlinGrid(origin / scale, step / scale, CHUNK_SIZE, 1, CHUNK_SIZE, octave.data());
+        for(size_t j = 0; j < CHUNK_AREA; j++)
+            out[j] += octave[j];
+    }
+
+    for(size_t j = 0; j < CHUNK_AREA; j++)
+        out[j] /= static_cast<float>(oct + 1);
 }
 
-void VGen::init(const WorldConfig &config)
+void VGen::implInit(const WorldConfig &config)
 {
     base = config.base;
     height = static_cast<float>((cheight = config.height) * CHUNK_SIZE);
     smooth = math::max(config.toml["generator"]["vgen_smooth"].value_or(64.0f), 1.0f);
-    rng = std::mt19937_64(seed = config.generator.seed);
+    boulders = math::clamp(config.toml["generator"]["vgen_boulders"].value_or(0.05f), 0.0f, 1.0f);
+
+    addKey(base);
+    addKey(cheight);
+    addKey(smooth);
+    addKey(boulders);
+    addKey(VGEN_SURFACE_DEPTH);
+    addKey(VGEN_BOULDER_RADIUS);
+
+    std::mt19937_64 rng = std::mt19937_64(seed);
     fseed = std::uniform_real_distribution<float>()(rng);
+
+    std::scoped_lock lock(cache_mutex);
+    cache.clear();
+    cache_lru.clear();
 }
 
-bool VGen::generate(const chunkpos_t &cp, voxel_array_t &chunk)
+bool VGen::implGenerate(const chunkpos_t &cp, VoxelStorage &data) const
 {
-    chunk.fill(NULL_VOXEL);
-
     // Don't generate past these values
     if(cp.y < base || cp.y > base + cheight)
         return false;
+
+    // Classify the whole chunk against the column
+    // extremes first: most chunks are either above
+    // the surface or buried below it completely.
+    const std::shared_ptr<const Heightmap> heightmap = getHeightmap(cp.x, cp.z);
+    if(cp.y > toChunkPos(voxelpos_t(0, heightmap->max_height, 0)).y + base)
+        return false;
+
+    if(cp.y < toChunkPos(voxelpos_t(0, heightmap->min_height, 0)).y + base) {
+        data.fill(VGEN_STONE);
+        return true;
+    }
+
     bool dirty = false;
+    voxel_array_t chunk;
+    chunk.fill(NULL_VOXEL);
 
     for(int16_t x = 0; x < CHUNK_SIZE; x++) {
         for(int16_t z = 0; z < CHUNK_SIZE; z++) {
-            const voxelpos_t vp = toVoxelPos(cp, localpos_t(x, 0, z));
-            const double3 vxz = double3(vp.x / smooth, fseed, vp.z / smooth);
-            const float hmod = octanoise(vxz, 2);
-            const size_t h = static_cast<size_t>(hmod * (height - 1.0f));
+            const size_t h = heightmap->heights[x * CHUNK_SIZE + z];
             const int32_t ch = toChunkPos(voxelpos_t(0, h, 0)).y + base;
 
             size_t ht = 0;
@@ -49,11 +93,162 @@ bool VGen::generate(const chunkpos_t &cp, voxel_array_t &chunk)
                 ht = h % CHUNK_SIZE;
 
             for(size_t i = 0; i < ht; i++) {
-                chunk[toVoxelIdx(localpos_t(x, i, z))] = 0x01;
+                chunk[toVoxelIdx(localpos_t(x, i, z))] = VGEN_STONE;
                 dirty = true;
             }
         }
     }
 
+    if(dirty)
+        data.assign(chunk);
     return dirty;
 }
+
+void VGen::surface(const chunkpos_t &, const GeneratorNeighbourhood &around, VoxelStorage &data) const
+{
+    // Nothing to cover in the air or deep underground
+    if(data.isUniform() && data.getUniform() == NULL_VOXEL)
+        return;
+    const VoxelStorage &above = *around.chunks[14];
+    if(data.isUniform() && above.isUniform() && above.getUniform() == VGEN_STONE)
+        return;
+
+    voxel_array_t chunk;
+    data.unpack(chunk);
+
+    for(int16_t x = 0; x < CHUNK_SIZE; x++) {
+        for(int16_t z = 0; z < CHUNK_SIZE; z++) {
+            for(int16_t y = 0; y < CHUNK_SIZE; y++) {
+                voxel_t &voxel = chunk[toVoxelIdx(localpos_t(x, y, z))];
+                if(voxel != VGEN_STONE)
+                    continue;
+
+                int32_t depth = 0;
+                while(depth < VGEN_SURFACE_DEPTH && around.get(x, y + depth + 1, z) != NULL_VOXEL)
+                    depth++;
+                if(depth < VGEN_SURFACE_DEPTH)
+                    voxel = depth ? VGEN_DIRT : VGEN_GRASS;
+            }
+        }
+    }
+
+    data.assign(chunk);
+}
+
+void VGen::decorate(const chunkpos_t &cp, const GeneratorNeighbourhood &around, VoxelStorage &data) const
+{
+    constexpr const int32_t size = static_cast<int32_t>(CHUNK_SIZE);
+
+    voxel_array_t chunk;
+    bool unpacked = false;
+
+    // Each boulder belongs to the chunk its center is in
+    // and every chunk it covers places its own part.
+    for(int32_t dx = -1; dx <= 1; dx++) {
+        for(int32_t dz = -1; dz <= 1; dz++) {
+            for(int32_t dy = -1; dy <= 1; dy++) {
+                std::mt19937_64 rng = std::mt19937_64(getChunkSeed(cp + chunkpos_t(dx, dy, dz)));
+                if(std::uniform_real_distribution<float>()(rng) >= boulders)
+                    continue;
+
+                const int32_t ox = dx * size + static_cast<int32_t>(rng() % size);
+                const int32_t oz = dz * size + static_cast<int32_t>(rng() % size);
+                const int32_t radius = 2 + static_cast<int32_t>(rng() % (VGEN_BOULDER_RADIUS - 1));
+
+                // Rest it on the topmost grass of the column
+                int32_t oy = size - 1;
+                for(; oy >= 0; oy--) {
+                    if(around.get(ox, dy * size + oy, oz) == VGEN_GRASS)
+                        break;
+                }
+
+                if(oy < 0)
+                    continue;
+                oy += dy * size + radius - 1;
+
+                const int32_t r2 = radius * radius + radius;
+                for(int32_t x = math::max(ox - radius, 0); x <= math::min(ox + radius, size - 1); x++) {
+                    for(int32_t z = math::max(oz - radius, 0); z <= math::min(oz + radius, size - 1); z++) {
+                        for(int32_t y = math::max(oy - radius, 0); y <= math::min(oy + radius, size - 1); y++) {
+                            if((x - ox) * (x - ox) + (y - oy) * (y - oy) + (z - oz) * (z - oz) > r2)
+                                continue;
+                            if(!unpacked) {
+                                data.unpack(chunk);
+                                unpacked = true;
+                            }
+
+                            chunk[toVoxelIdx(localpos_t(x, y, z))] = VGEN_STONE;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if(unpacked)
+        data.assign(chunk);
+}
+
+void VGen::logStats() const
+{
+    spdlog::info("Heightmap cache: {} hits, {} misses", getCacheHits(), getCacheMisses());
+}
+
+size_t VGen::getCacheHits() const
+{
+    std::scoped_lock lock(cache_mutex);
+    return cache_hits;
+}
+
+size_t VGen::getCacheMisses() const
+{
+    std::scoped_lock lock(cache_mutex);
+    return cache_misses;
+}
+
+std::shared_ptr<const Heightmap> VGen::getHeightmap(int32_t cx, int32_t cz) const
+{
+    const uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint64_t>(static_cast<uint32_t>(cz));
+
+    {
+        std::scoped_lock lock(cache_mutex);
+        const auto it = cache.find(key);
+        if(it != cache.cend()) {
+            cache_lru.splice(cache_lru.begin(), cache_lru, it->second.second);
+            cache_hits++;
+            return it->second.first;
+        }
+
+        cache_misses++;
+    }
+
+    // Computed without holding the lock. Two workers may
+    // compute the same column at once; the results match.
+    const voxelpos_t vp = toVoxelPos(chunkpos_t(cx, 0, cz), localpos_t(0, 0, 0));
+    const double3 origin = double3(vp.x / smooth, fseed, vp.z / smooth);
+    const double3 step = double3(1.0 / smooth, 0.0, 1.0 / smooth);
+
+    std::array<float, CHUNK_AREA> hmod;
+    octanoise(origin, step, 2, hmod);
+
+    std::shared_ptr<Heightmap> heightmap = std::make_shared<Heightmap>();
+    heightmap->min_height = UINT32_MAX;
+    heightmap->max_height = 0;
+    for(size_t j = 0; j < CHUNK_AREA; j++) {
+        heightmap->heights[j] = static_cast<uint32_t>(hmod[j] * (height - 1.0f));
+        heightmap->min_height = math::min(heightmap->min_height, heightmap->heights[j]);
+        heightmap->max_height = math::max(heightmap->max_height, heightmap->heights[j]);
+    }
+
+    std::scoped_lock lock(cache_mutex);
+    if(!cache.count(key)) {
+        cache_lru.push_front(key);
+        cache[key] = std::make_pair(heightmap, cache_lru.begin());
+        while(cache.size() > HEIGHTMAP_CACHE_SIZE) {
+            cache.erase(cache_lru.back());
+            cache_lru.pop_back();
+        }
+    }
+
+    return heightmap;
+}
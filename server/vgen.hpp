@@ -4,19 +4,58 @@
  * Created: Sun Dec 12 2021 23:33:46
  */
 #pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <server/generator.hpp>
 #include <shared/chunks.hpp>
+#include <shared/voxel_storage.hpp>
 #include <random>
+#include <unordered_map>
 
-class WorldConfig;
-class VGen final {
+constexpr static const size_t HEIGHTMAP_CACHE_SIZE = 1024;
+
+// Surface height for each (x, z) of a chunk column
+// along with the extremes used to classify chunks.
+struct Heightmap final {
+    std::array<uint32_t, CHUNK_AREA> heights;
+    uint32_t min_height;
+    uint32_t max_height;
+};
+
+// generate() is called from worker threads so it must
+// not touch any shared mutable state. Randomness has to
+// come from a per-chunk RNG seeded by getChunkSeed() so
+// the output doesn't depend on the order of generation.
+// surface() covers the exposed stone with grass and dirt
+// and decorate() places boulders that may cross borders.
+class VGen final : public BaseGenerator<VGen> {
 public:
-    void init(const WorldConfig &config);
-    bool generate(const chunkpos_t &cp, voxel_array_t &chunk);
+    constexpr static const generator_flags_t FLAGS = GENERATOR_CONCURRENT | GENERATOR_DETERMINISTIC | GENERATOR_STAGED;
+
+    void implInit(const WorldConfig &config);
+    bool implGenerate(const chunkpos_t &cp, VoxelStorage &data) const;
+    void surface(const chunkpos_t &cp, const GeneratorNeighbourhood &around, VoxelStorage &data) const override;
+    void decorate(const chunkpos_t &cp, const GeneratorNeighbourhood &around, VoxelStorage &data) const override;
+    void logStats() const override;
+
+    size_t getCacheHits() const;
+    size_t getCacheMisses() const;
+
+private:
+    // Heights are shared by all the chunks of a column
+    // so they are cached by (cx, cz) with LRU eviction.
+    std::shared_ptr<const Heightmap> getHeightmap(int32_t cx, int32_t cz) const;
 
 private:
     int32_t base, cheight;
     float height, smooth;
-    std::mt19937_64 rng;
-    uint64_t seed;
     float fseed;
+    float boulders;
+
+    mutable std::mutex cache_mutex;
+    mutable std::list<uint64_t> cache_lru;
+    mutable std::unordered_map<uint64_t, std::pair<std::shared_ptr<const Heightmap>, std::list<uint64_t>::iterator>> cache;
+    mutable size_t cache_hits { 0 };
+    mutable size_t cache_misses { 0 };
 };
@@ -10,11 +10,13 @@ namespace protocol::packets
 {
 struct Handshake final : public ClientPacket<0x000> {
     uint16_t protocol_version { protocol::VERSION };
+    protocol::features_t features { protocol::FEATURES };
 
     template<typename S>
     inline void serialize(S &s)
     {
         s.value2b(protocol_version);
+        s.value4b(features);
     }
 };
 } // namespace protocol::packets
@@ -0,0 +1,27 @@
+/*
+ * chunk_voxels_rle.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <shared/protocol/protocol.hpp>
+#include <shared/world.hpp>
+
+namespace protocol::packets
+{
+// ChunkVoxels with the data encoded by voxel_rle.
+// Sent instead of it to the clients that announce
+// FEATURE_CHUNK_RLE in their Handshake, unless the
+// encoded data is not smaller than the raw one.
+struct ChunkVoxelsRLE final : public ServerPacket<0x00C> {
+    chunkpos_t::value_type position[3];
+    std::vector<uint8_t> data;
+
+    template<typename S>
+    inline void serialize(S &s)
+    {
+        s.container4b(position);
+        s.container1b(data, sizeof(voxel_t) * CHUNK_VOLUME);
+    }
+};
+} // namespace protocol::packets
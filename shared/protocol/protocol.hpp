@@ -16,10 +16,17 @@
 
 namespace protocol
 {
-constexpr static const uint16_t VERSION = 0;
+constexpr static const uint16_t VERSION = 1;
 constexpr static const uint16_t DEFAULT_PORT = 43103;
 constexpr static const float DEFAULT_TICKRATE = 30.0f;
 
+// Optional protocol features. The client announces
+// the ones it supports in Handshake and the server
+// uses the ones both sides know about.
+using features_t = uint32_t;
+constexpr static const features_t FEATURE_CHUNK_RLE = (1 << 0);
+constexpr static const features_t FEATURES = FEATURE_CHUNK_RLE;
+
 template<uint16_t packet_id>
 struct Packet { constexpr static const uint16_t id = packet_id; };
 template<uint16_t packet_id>
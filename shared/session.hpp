@@ -11,6 +11,7 @@
 #include <string>
 #include <deque>
 #include <unordered_set>
+#include <vector>
 
 enum class SessionState {
     DISCONNECTED,
@@ -41,7 +42,21 @@ struct ClientSession final : public Session {
 };
 
 struct ServerSession final : public Session {
+    // Protocol features both sides support
+    uint32_t features { 0 };
+
     // When we disconnect we must reduce
     // the reference count of these chunks
     std::unordered_set<chunkpos_t> loaded_chunks;
+
+    // Ready chunks that haven't been sent yet.
+    // Drained each tick closest and in view first.
+    std::unordered_set<chunkpos_t> send_queue;
+
+    // Login progress while RECEIVING_GAMEDATA:
+    // the stage, the position within it and the
+    // sessions that were there when it started.
+    ServerGameDataState gamedata_state { ServerGameDataState::VOXEL_DEF };
+    size_t gamedata_cursor { 0 };
+    std::vector<uint32_t> gamedata_peers;
 };
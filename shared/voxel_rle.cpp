@@ -0,0 +1,48 @@
+/*
+ * voxel_rle.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <shared/voxel_rle.hpp>
+
+void voxel_rle::encode(const voxel_array_t &array, std::vector<uint8_t> &buffer)
+{
+    for(voxelidx_t i = 0; i < CHUNK_VOLUME;) {
+        const voxel_t voxel = array[i];
+        voxelidx_t run = 1;
+        while(i + run < CHUNK_VOLUME && array[i + run] == voxel)
+            run++;
+        i += run;
+
+        for(run--; run >= 0x80; run >>= 7)
+            buffer.push_back(static_cast<uint8_t>(run | 0x80));
+        buffer.push_back(static_cast<uint8_t>(run));
+        buffer.push_back(voxel);
+    }
+}
+
+bool voxel_rle::decode(const uint8_t *buffer, size_t size, voxel_array_t &array)
+{
+    voxelidx_t i = 0;
+    const uint8_t *end = buffer + size;
+    while(buffer < end) {
+        voxelidx_t run = 0;
+        for(unsigned int shift = 0;; shift += 7) {
+            if(buffer == end || shift > 14)
+                return false;
+            const uint8_t byte = *buffer++;
+            run |= static_cast<voxelidx_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+                break;
+        }
+
+        if(buffer == end || i + run + 1 > CHUNK_VOLUME)
+            return false;
+
+        const voxel_t voxel = *buffer++;
+        for(run++; run--;)
+            array[i++] = voxel;
+    }
+
+    return i == CHUNK_VOLUME;
+}
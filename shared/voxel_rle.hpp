@@ -0,0 +1,16 @@
+/*
+ * voxel_rle.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <shared/world.hpp>
+
+// Run-length encoding of voxel arrays: a sequence
+// of (varint run length - 1, voxel) pairs. Terrain
+// is stored in vertical columns so runs are long.
+namespace voxel_rle
+{
+void encode(const voxel_array_t &array, std::vector<uint8_t> &buffer);
+bool decode(const uint8_t *buffer, size_t size, voxel_array_t &array);
+} // namespace voxel_rle
@@ -0,0 +1,155 @@
+/*
+ * voxel_storage.cpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#include <numeric>
+#include <shared/voxel_storage.hpp>
+
+static inline const unsigned int bitsForPalette(size_t size)
+{
+    if(size <= 1)
+        return 0;
+    if(size <= 2)
+        return 1;
+    if(size <= 4)
+        return 2;
+    if(size <= 16)
+        return 4;
+    return 8;
+}
+
+static inline const size_t indexArraySize(unsigned int bits)
+{
+    return CHUNK_VOLUME * bits / 8;
+}
+
+static inline const uint8_t readIndex(const std::vector<uint8_t> &indices, unsigned int bits, voxelidx_t idx)
+{
+    if(!bits)
+        return 0;
+    const size_t bit = idx * bits;
+    return (indices[bit >> 3] >> (bit & 7)) & ((1 << bits) - 1);
+}
+
+static inline void writeIndex(std::vector<uint8_t> &indices, unsigned int bits, voxelidx_t idx, uint8_t value)
+{
+    const size_t bit = idx * bits;
+    const uint8_t mask = static_cast<uint8_t>(((1 << bits) - 1) << (bit & 7));
+    uint8_t &byte = indices[bit >> 3];
+    byte = static_cast<uint8_t>((byte & ~mask) | ((value << (bit & 7)) & mask));
+}
+
+VoxelStorage::VoxelStorage(voxel_t voxel)
+    : bits(0), palette(1, voxel), indices()
+{
+
+}
+
+void VoxelStorage::fill(voxel_t voxel)
+{
+    bits = 0;
+    palette.assign(1, voxel);
+    palette.shrink_to_fit();
+    indices.clear();
+    indices.shrink_to_fit();
+}
+
+void VoxelStorage::assign(const voxel_array_t &array)
+{
+    constexpr const uint16_t NO_INDEX = 0xFFFF;
+    std::array<uint16_t, MAX_VOXELS> lookup;
+    lookup.fill(NO_INDEX);
+
+    palette.clear();
+    for(const voxel_t voxel : array) {
+        if(lookup[voxel] == NO_INDEX) {
+            lookup[voxel] = static_cast<uint16_t>(palette.size());
+            palette.push_back(voxel);
+        }
+    }
+
+    bits = bitsForPalette(palette.size());
+    indices.assign(indexArraySize(bits), 0);
+    if(bits) {
+        for(voxelidx_t i = 0; i < CHUNK_VOLUME; i++)
+            writeIndex(indices, bits, i, static_cast<uint8_t>(lookup[array[i]]));
+    }
+
+    palette.shrink_to_fit();
+    indices.shrink_to_fit();
+}
+
+void VoxelStorage::unpack(voxel_array_t &array) const
+{
+    if(!bits) {
+        array.fill(palette[0]);
+        return;
+    }
+
+    for(voxelidx_t i = 0; i < CHUNK_VOLUME; i++)
+        array[i] = palette[readIndex(indices, bits, i)];
+}
+
+void VoxelStorage::set(voxelidx_t idx, voxel_t voxel)
+{
+    size_t pi = 0;
+    while(pi < palette.size() && palette[pi] != voxel)
+        pi++;
+
+    if(pi == palette.size()) {
+        if(palette.size() >= (static_cast<size_t>(1) << bits)) {
+            std::vector<uint8_t> remap(palette.size());
+            std::iota(remap.begin(), remap.end(), 0);
+            repack(bitsForPalette(palette.size() + 1), remap);
+        }
+
+        palette.push_back(voxel);
+    }
+
+    if(bits)
+        writeIndex(indices, bits, idx, static_cast<uint8_t>(pi));
+}
+
+void VoxelStorage::optimize()
+{
+    if(!bits)
+        return;
+
+    std::vector<size_t> counts(palette.size(), 0);
+    for(voxelidx_t i = 0; i < CHUNK_VOLUME; i++)
+        counts[readIndex(indices, bits, i)]++;
+
+    std::vector<uint8_t> remap(palette.size(), 0);
+    std::vector<voxel_t> new_palette;
+    for(size_t i = 0; i < palette.size(); i++) {
+        if(counts[i]) {
+            remap[i] = static_cast<uint8_t>(new_palette.size());
+            new_palette.push_back(palette[i]);
+        }
+    }
+
+    if(new_palette.size() == palette.size())
+        return;
+
+    repack(bitsForPalette(new_palette.size()), remap);
+    palette = std::move(new_palette);
+    palette.shrink_to_fit();
+}
+
+size_t VoxelStorage::getMemoryUsage() const
+{
+    return sizeof(VoxelStorage) + palette.capacity() * sizeof(voxel_t) + indices.capacity();
+}
+
+void VoxelStorage::repack(unsigned int new_bits, const std::vector<uint8_t> &remap)
+{
+    std::vector<uint8_t> new_indices(indexArraySize(new_bits), 0);
+    if(new_bits) {
+        for(voxelidx_t i = 0; i < CHUNK_VOLUME; i++)
+            writeIndex(new_indices, new_bits, i, remap[readIndex(indices, bits, i)]);
+    }
+
+    bits = new_bits;
+    indices = std::move(new_indices);
+}
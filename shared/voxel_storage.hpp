@@ -0,0 +1,66 @@
+/*
+ * voxel_storage.hpp
+ * Copyright (c) 2021, Kirill GPRB.
+ * All Rights Reserved.
+ */
+#pragma once
+#include <shared/world.hpp>
+#include <vector>
+
+// Palette-compressed voxel container. Each voxel is
+// stored as an index into a small palette of voxel IDs
+// that is packed into 0, 1, 2, 4 or 8 bits. A chunk of
+// a single voxel type has no index array at all: it is
+// materialized by the first set() of a different voxel.
+class VoxelStorage final {
+public:
+    VoxelStorage(voxel_t voxel = NULL_VOXEL);
+
+    void fill(voxel_t voxel);
+    void assign(const voxel_array_t &array);
+    void unpack(voxel_array_t &array) const;
+    void set(voxelidx_t idx, voxel_t voxel);
+
+    // Drops unused palette entries and shrinks
+    // the index array down to the minimum width.
+    void optimize();
+
+    size_t getMemoryUsage() const;
+
+    inline voxel_t get(voxelidx_t idx) const
+    {
+        if(!bits)
+            return palette[0];
+        const size_t bit = idx * bits;
+        return palette[(indices[bit >> 3] >> (bit & 7)) & ((1 << bits) - 1)];
+    }
+
+    inline bool isUniform() const
+    {
+        return !bits;
+    }
+
+    // Valid only for uniform storages
+    inline voxel_t getUniform() const
+    {
+        return palette[0];
+    }
+
+    inline unsigned int getBits() const
+    {
+        return bits;
+    }
+
+    inline size_t getPaletteSize() const
+    {
+        return palette.size();
+    }
+
+private:
+    void repack(unsigned int new_bits, const std::vector<uint8_t> &remap);
+
+private:
+    unsigned int bits;
+    std::vector<voxel_t> palette;
+    std::vector<uint8_t> indices;
+};